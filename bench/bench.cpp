@@ -0,0 +1,321 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <alias.h>
+#include <launcher.h>
+#include <tsh.h>
+
+using namespace std;
+
+/**
+ * @brief Allocation counting.
+ *
+ * glibc lets a program replace malloc and friends, and routes its own
+ * internal allocations (strdup, operator new, ...) through the replacement.
+ * Every call is forwarded to the real allocator and counted so each benchmark
+ * can report allocations/line.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static atomic<size_t> alloc_count(0);
+
+extern "C" {
+void *malloc(size_t size) {
+  alloc_count.fetch_add(1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  alloc_count.fetch_add(1, memory_order_relaxed);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_count.fetch_add(1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+}
+
+/**
+ * @brief The corpus of command lines each benchmark is run over.
+ *
+ * Each set models one shape of line seen in practice: short interactive
+ * commands, long argument lists, many pipe stages, many tokens and lines with
+ * heavy quoting.
+ */
+static const vector<string> corpus_short = {
+    "ls",
+    "pwd",
+    "ls -l",
+    "cat file.txt",
+    "echo hi",
+    "quit",
+};
+
+static const vector<string> corpus_long = {
+    "gcc -O2 -Wall -Wextra -Iinclude -Ithird_party/include -DNDEBUG -c "
+    "src/very/deeply/nested/module/translation_unit.cpp -o obj/unit.o",
+    "rsync -avz --delete --exclude=.git --exclude=node_modules "
+    "/home/user/projects/service/ backup@host.example.com:/srv/backups/svc/",
+    "find /var/log/application/production -name access-2024-*.log "
+    "-newer /var/log/application/production/last_rotation -print",
+};
+
+static const vector<string> corpus_pipes = {
+    "cat a | grep x | sort | uniq -c | sort -n | tail -n 5",
+    "ps aux | grep tsh | grep -v grep | wc -l",
+    "cat a | cat | cat | cat | cat | cat | cat | cat | cat | cat | cat | cat",
+    "ls; pwd; ls -l | wc -l; echo done",
+};
+
+static const vector<string> corpus_tokens = {
+    "echo a b c d e f g h i j k l m n o p q r s t u v w x",
+    "tar cf out.tar f1 f2 f3 f4 f5 f6 f7 f8 f9 f10 f11 f12 f13 f14 f15",
+    "printf %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s",
+};
+
+static const vector<string> corpus_quotes = {
+    "echo \"hello world\" 'single quoted' \"a \\\"nested\\\" quote\"",
+    "grep -e \"foo bar\" -e 'baz qux' \"file with spaces.txt\"",
+    "awk '{ print $1, $2 }' \"in put.txt\" | sort -t ',' -k 2",
+};
+
+/**
+ * @brief Reports the per-line counters shared by every benchmark.
+ *
+ * ns_per_line is expressed as a rate counter over (lines * 1e-9) and inverted,
+ * so the JSON value is the wall time per line in nanoseconds.
+ */
+static void report(benchmark::State &state, size_t lines, size_t bytes,
+                   size_t allocs) {
+  state.SetItemsProcessed(lines);
+  state.SetBytesProcessed(bytes);
+  state.counters["ns_per_line"] = benchmark::Counter(
+      lines * 1e-9, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  state.counters["allocs_per_line"] =
+      benchmark::Counter(lines ? (double)allocs / lines : 0.0);
+}
+
+static size_t corpus_bytes(const vector<string> &corpus) {
+  size_t bytes = 0;
+  for (const string &line : corpus) bytes += line.size() + 1;
+  return bytes;
+}
+
+/**
+ * @brief read_input() over the corpus, fed through a replaced cin buffer.
+ *
+ * cout is redirected as well so prompt output does not dominate the timing.
+ */
+static void BM_ReadInput(benchmark::State &state, const vector<string> *corpus) {
+  string text;
+  for (const string &line : *corpus) text += line + "\n";
+  stringstream null_out;
+  streambuf *old_out = cout.rdbuf(null_out.rdbuf());
+  istringstream in(text);
+  streambuf *old_in = cin.rdbuf(in.rdbuf());
+  size_t lines = 0, allocs = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < corpus->size(); i++) {
+      if (!cin.good()) {
+        cin.clear();
+        in.clear();
+        in.seekg(0);
+      }
+      size_t before = alloc_count.load(memory_order_relaxed);
+      char *line = read_input();
+      allocs += alloc_count.load(memory_order_relaxed) - before;
+      benchmark::DoNotOptimize(line);
+      free(line);
+    }
+    lines += corpus->size();
+    null_out.str("");
+  }
+  cin.rdbuf(old_in);
+  cout.rdbuf(old_out);
+  report(state, lines, state.iterations() * corpus_bytes(*corpus), allocs);
+}
+
+/**
+ * @brief parse_input() over the corpus, including the split_string() calls
+ * it makes and the cleanup of the resulting process list.
+ */
+static void BM_ParseInput(benchmark::State &state,
+                          const vector<string> *corpus) {
+  list<Process *> process_list;
+  size_t lines = 0;
+  size_t before = alloc_count.load(memory_order_relaxed);
+  for (auto _ : state) {
+    for (const string &line : *corpus) {
+      parse_input((char *)line.c_str(), process_list);
+      benchmark::DoNotOptimize(process_list.size());
+      for (Process *p : process_list) delete p;
+      process_list.clear();
+    }
+    lines += corpus->size();
+  }
+  size_t allocs = alloc_count.load(memory_order_relaxed) - before;
+  report(state, lines, state.iterations() * corpus_bytes(*corpus), allocs);
+}
+
+/**
+ * @brief Process::split_string() alone, on one Process per corpus line.
+ * The Processes are built and freed with the timer paused.
+ */
+static void BM_SplitString(benchmark::State &state,
+                           const vector<string> *corpus) {
+  vector<Process *> procs;
+  size_t lines = 0, allocs = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (const string &line : *corpus) {
+      procs.push_back(new Process((char *)line.c_str(), 0, 0));
+    }
+    state.ResumeTiming();
+    size_t before = alloc_count.load(memory_order_relaxed);
+    for (Process *p : procs) {
+      p->split_string();
+      benchmark::DoNotOptimize(p->cmdTokens[0]);
+    }
+    allocs += alloc_count.load(memory_order_relaxed) - before;
+    state.PauseTiming();
+    for (Process *p : procs) delete p;
+    procs.clear();
+    state.ResumeTiming();
+    lines += corpus->size();
+  }
+  report(state, lines, state.iterations() * corpus_bytes(*corpus), allocs);
+}
+
+/**
+ * @brief isQuit() on every Process of the parsed corpus.
+ */
+static void BM_IsQuit(benchmark::State &state, const vector<string> *corpus) {
+  list<Process *> process_list;
+  for (const string &line : *corpus) {
+    list<Process *> parsed;
+    parse_input((char *)line.c_str(), parsed);
+    process_list.splice(process_list.end(), parsed);
+  }
+  size_t lines = 0;
+  size_t before = alloc_count.load(memory_order_relaxed);
+  for (auto _ : state) {
+    for (Process *p : process_list) {
+      benchmark::DoNotOptimize(isQuit(p));
+    }
+    lines += process_list.size();
+  }
+  size_t allocs = alloc_count.load(memory_order_relaxed) - before;
+  for (Process *p : process_list) delete p;
+  report(state, lines, 0, allocs);
+}
+
+/**
+ * @brief cleanup() of a process list and input line parsed from each corpus
+ * line. Parsing happens with the timer paused.
+ */
+static void BM_Cleanup(benchmark::State &state, const vector<string> *corpus) {
+  vector<list<Process *>> process_lists(corpus->size());
+  vector<char *> input_lines(corpus->size());
+  size_t lines = 0, allocs = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (size_t i = 0; i < corpus->size(); i++) {
+      input_lines[i] = strdup((*corpus)[i].c_str());
+      parse_input(input_lines[i], process_lists[i]);
+    }
+    state.ResumeTiming();
+    size_t before = alloc_count.load(memory_order_relaxed);
+    for (size_t i = 0; i < corpus->size(); i++) {
+      cleanup(process_lists[i], input_lines[i]);
+    }
+    allocs += alloc_count.load(memory_order_relaxed) - before;
+    lines += corpus->size();
+  }
+  report(state, lines, state.iterations() * corpus_bytes(*corpus), allocs);
+}
+
+/**
+ * @brief run_commands() scheduling cost, on a FakeLauncher so no process is
+ * created. Reports simulated jobs per second.
+ */
+static void BM_RunCommandsFake(benchmark::State &state,
+                               const vector<string> *corpus) {
+  FakeLauncher launcher;
+  const char *names[] = {"ls", "pwd", "cat", "echo", "grep", "sort", "uniq",
+                         "wc", "ps", "tail", "gcc", "rsync", "find", "tar",
+                         "printf", "awk"};
+  for (const char *name : names) launcher.set_program(name, 1000, "x\n");
+  vector<list<Process *>> process_lists(corpus->size());
+  for (size_t i = 0; i < corpus->size(); i++) {
+    parse_input((char *)(*corpus)[i].c_str(), process_lists[i]);
+  }
+  size_t lines = 0;
+  size_t before = alloc_count.load(memory_order_relaxed);
+  for (auto _ : state) {
+    for (list<Process *> &process_list : process_lists) {
+      benchmark::DoNotOptimize(run_commands(process_list, launcher));
+    }
+    launcher.stdout_data.clear();
+    lines += corpus->size();
+  }
+  size_t allocs = alloc_count.load(memory_order_relaxed) - before;
+  state.counters["jobs_per_second"] =
+      benchmark::Counter(launcher.launched, benchmark::Counter::kIsRate);
+  report(state, lines, 0, allocs);
+  for (list<Process *> &process_list : process_lists) {
+    cleanup(process_list, nullptr);
+  }
+}
+
+/**
+ * @brief parse_input() of a line calling a function whose body is an
+ * 8-stage pipeline. With state.range(0) set the function is redefined
+ * before every parse, so the cached expansion is never used.
+ */
+static void BM_ParseFunctionCall(benchmark::State &state) {
+  string body = "grep -v x $1";
+  for (int i = 0; i < 7; i++) body += " | sed s/a/b/ $2";
+  set_function("bench_fn", body);
+  string line = "bench_fn one two | wc -l";
+  list<Process *> process_list;
+  size_t lines = 0;
+  size_t before = alloc_count.load(memory_order_relaxed);
+  for (auto _ : state) {
+    if (state.range(0)) set_function("bench_fn", body);
+    parse_input((char *)line.c_str(), process_list);
+    benchmark::DoNotOptimize(process_list.size());
+    cleanup(process_list, nullptr);
+    lines++;
+  }
+  size_t allocs = alloc_count.load(memory_order_relaxed) - before;
+  report(state, lines, state.iterations() * line.size(), allocs);
+  remove_function("bench_fn");
+}
+BENCHMARK(BM_ParseFunctionCall)->ArgName("uncached")->Arg(0)->Arg(1);
+
+#define BENCH_CORPUS(fn)                              \
+  BENCHMARK_CAPTURE(fn, short, &corpus_short);        \
+  BENCHMARK_CAPTURE(fn, long, &corpus_long);          \
+  BENCHMARK_CAPTURE(fn, pipes, &corpus_pipes);        \
+  BENCHMARK_CAPTURE(fn, tokens, &corpus_tokens);      \
+  BENCHMARK_CAPTURE(fn, quotes, &corpus_quotes)
+
+BENCH_CORPUS(BM_ReadInput);
+BENCH_CORPUS(BM_ParseInput);
+BENCH_CORPUS(BM_SplitString);
+BENCH_CORPUS(BM_IsQuit);
+BENCH_CORPUS(BM_Cleanup);
+BENCH_CORPUS(BM_RunCommandsFake);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+"""End-to-end benchmark harness for tsh_app.
+
+Drives tsh_app non-interactively (commands on stdin, no prompt) and measures
+what the microbenchmarks in bench.cpp cannot: process launch rate, launch
+latency, pipeline throughput and peak RSS.
+
+Workloads:
+  launch    N x `true`, one command per line             -> commands/s
+  wide      one line of N `true` commands joined by ';'  -> commands/s
+  latency   N x `echo i`, each round-tripped on its own  -> p50/p99 latency
+  yes       `yes | head -c BYTES | wc -c`                -> MB/s
+  chain-K   `head -c BYTES /dev/zero | cat | ... | wc -c` with K stages -> MB/s
+  chain-K-pinned
+            chain-K with TSH_AFFINITY=cache, stages pinned to cpus sharing
+            a cache; compare with chain-K for the gain -> MB/s
+  read-loop `cat FILE | while read -r a b; do echo $b $a; done` over 100*N
+            lines                                  -> lines/s, x faster than bash
+  startup   `tsh -c true` with no startup file         -> p50 startup latency
+  startup-rc
+            `tsh -c true` with a startup file of N definitions, replayed
+            from its snapshot                      -> p50 startup latency
+  startup-rc-cold
+            startup-rc with the snapshot removed before each run, so the
+            file is parsed every time              -> p50 startup latency
+
+Every workload is repeated --repeat times and the median is reported. Results
+are written as JSON; --save-baseline keeps them, --baseline compares against a
+saved run and exits non-zero if any metric regressed by more than
+--tolerance.
+
+Usage:
+  bench/pipeline_bench.py [--quick] [--out results.json]
+                          [--save-baseline base.json | --baseline base.json]
+                          [--speedup-out speedup.json]
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+CHAIN_STAGES = [2, 4, 8, 16, 32, 64]
+PINNED_STAGES = [2, 4, 8]
+
+# metric name -> True if higher is better
+METRICS = {
+    "commands_per_sec": True,
+    "mb_per_sec": True,
+    "p50_latency_us": False,
+    "p99_latency_us": False,
+    "peak_rss_kb": False,
+    "lines_per_sec": True,
+    "x_bash": True,
+    "p50_startup_us": False,
+}
+
+
+def parse_size(text):
+    """Parses sizes such as 64M or 10G into bytes."""
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    if text[-1].upper() in units:
+        return int(text[:-1]) * units[text[-1].upper()]
+    return int(text)
+
+
+def run_tsh_rusage(tsh, script, env=None):
+    """Runs tsh with script on stdin; returns (seconds, stdout, peak_rss_kb).
+
+    env holds variables to set for tsh on top of the current environment.
+
+    The child is reaped with wait4, which reports the peak RSS of tsh and of
+    every child it reaped, so this covers the shell and all pipeline stages.
+    """
+    start = time.perf_counter()
+    r, w = os.pipe()
+    out_r, out_w = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.dup2(r, 0)
+        os.dup2(out_w, 1)
+        for fd in (r, w, out_r, out_w):
+            os.close(fd)
+        os.execve(tsh, [tsh], dict(os.environ, **(env or {})))
+    os.close(r)
+    os.close(out_w)
+    with os.fdopen(w, "wb") as stdin:
+        stdin.write(script.encode())
+    with os.fdopen(out_r, "rb") as stdout:
+        out = stdout.read()
+    _, status, usage = os.wait4(pid, 0)
+    elapsed = time.perf_counter() - start
+    if status != 0:
+        sys.exit("tsh exited with status %d" % status)
+    return elapsed, out, usage.ru_maxrss
+
+
+def bench_launch(tsh, n):
+    elapsed, _, rss = run_tsh_rusage(tsh, "true\n" * n)
+    return {"commands_per_sec": n / elapsed, "peak_rss_kb": rss}
+
+
+def bench_wide(tsh, n):
+    elapsed, _, rss = run_tsh_rusage(tsh, ";".join(["true"] * n) + "\n")
+    return {"commands_per_sec": n / elapsed, "peak_rss_kb": rss}
+
+
+def bench_latency(tsh, n):
+    """Measures write-command to read-output latency for each command."""
+    proc = subprocess.Popen([tsh], stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, bufsize=0)
+    samples = []
+    for i in range(n):
+        start = time.perf_counter()
+        proc.stdin.write(b"echo %d\n" % i)
+        line = proc.stdout.readline()
+        samples.append((time.perf_counter() - start) * 1e6)
+        if not line:
+            sys.exit("tsh exited during latency workload")
+    proc.stdin.close()
+    _, _, usage = os.wait4(proc.pid, 0)
+    samples.sort()
+    return {
+        "p50_latency_us": samples[len(samples) // 2],
+        "p99_latency_us": samples[min(len(samples) - 1,
+                                      int(len(samples) * 0.99))],
+        "peak_rss_kb": usage.ru_maxrss,
+    }
+
+
+def bench_pipe(tsh, line, nbytes, env=None):
+    elapsed, out, rss = run_tsh_rusage(tsh, line + "\n", env)
+    if int(out.split()[0]) != nbytes:
+        sys.exit("pipeline produced %s bytes, expected %d" % (out, nbytes))
+    return {"mb_per_sec": nbytes / elapsed / 1e6, "peak_rss_kb": rss}
+
+
+def bench_read_loop(tsh, nlines):
+    """Times a `while read` loop in tsh and, if it is installed, in bash."""
+    with tempfile.NamedTemporaryFile("w", suffix=".txt") as f:
+        f.write("".join("%d line of text\n" % i for i in range(nlines)))
+        f.flush()
+        loop = "cat %s | while read -r a b; do echo $b $a; done | wc -l" % \
+            f.name
+        elapsed, out, rss = run_tsh_rusage(tsh, loop + "\n")
+        if int(out.split()[0]) != nlines:
+            sys.exit("read loop produced %s lines, expected %d" %
+                     (out, nlines))
+        result = {"lines_per_sec": nlines / elapsed, "peak_rss_kb": rss}
+        if shutil.which("bash"):
+            start = time.perf_counter()
+            subprocess.run(["bash", "-c", loop], stdout=subprocess.DEVNULL,
+                           check=True)
+            result["x_bash"] = (time.perf_counter() - start) / elapsed
+    return result
+
+
+def bench_startup(tsh, ndefs, cold):
+    """Times `tsh -c true`, with a startup file of ndefs definitions if
+    ndefs is not 0."""
+    with tempfile.TemporaryDirectory() as tmp:
+        rc = os.path.join(tmp, "tshrc")
+        cache = os.path.join(tmp, "cache")
+        with open(rc, "w") as f:
+            # mostly shell variables: every export also slows down each
+            # exec, which would hide the time spent on the file itself
+            for i in range(ndefs):
+                if i % 100 == 0:
+                    f.write("export TSH_BENCH_%d=$HOME/v%d\n" % (i, i))
+                else:
+                    f.write("V%d=$HOME/v%d; W%d=%d\n" % (i, i, i, i))
+        env = dict(os.environ, TSH_RC=rc if ndefs else "",
+                   XDG_CACHE_HOME=cache)
+        samples = []
+        for _ in range(50):
+            if cold:
+                shutil.rmtree(cache, ignore_errors=True)
+            start = time.perf_counter()
+            subprocess.run([tsh, "-c", "true"], env=env, check=True)
+            samples.append((time.perf_counter() - start) * 1e6)
+    samples.sort()
+    return {"p50_startup_us": samples[len(samples) // 2]}
+
+
+def median_of(fn, repeat):
+    runs = [fn() for _ in range(repeat)]
+    return {k: statistics.median(r[k] for r in runs) for k in runs[0]}
+
+
+def run_all(args):
+    nbytes = parse_size(args.bytes)
+    workloads = {
+        "launch": lambda: bench_launch(args.tsh, args.n),
+        "wide": lambda: bench_wide(args.tsh, args.n),
+        "latency": lambda: bench_latency(args.tsh, args.n),
+        "yes": lambda: bench_pipe(
+            args.tsh, "yes | head -c %d | wc -c" % nbytes, nbytes),
+        "read-loop": lambda: bench_read_loop(args.tsh, args.n * 100),
+        "startup": lambda: bench_startup(args.tsh, 0, False),
+        "startup-rc": lambda: bench_startup(args.tsh, args.n, False),
+        "startup-rc-cold": lambda: bench_startup(args.tsh, args.n, True),
+    }
+    for k in CHAIN_STAGES:
+        line = "head -c %d /dev/zero" % nbytes + " | cat" * (k - 2) + \
+            " | wc -c"
+        workloads["chain-%d" % k] = \
+            (lambda line=line: bench_pipe(args.tsh, line, nbytes))
+        if k in PINNED_STAGES:
+            workloads["chain-%d-pinned" % k] = \
+                (lambda line=line: bench_pipe(args.tsh, line, nbytes,
+                                              {"TSH_AFFINITY": "cache"}))
+    results = {}
+    for name, fn in workloads.items():
+        if args.only and name not in args.only:
+            continue
+        results[name] = median_of(fn, args.repeat)
+        print("%-10s %s" % (name, "  ".join(
+            "%s=%.1f" % kv for kv in results[name].items())), flush=True)
+    return results
+
+
+def environment():
+    try:
+        rev = subprocess.check_output(
+            ["git", "rev-parse", "--short", "HEAD"],
+            stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        rev = "unknown"
+    return {
+        "kernel": platform.release(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "git_rev": rev,
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+    }
+
+
+def compare(results, baseline, tolerance):
+    """Prints the change of every metric; returns the number of regressions."""
+    regressions = 0
+    for name, metrics in results.items():
+        base = baseline.get(name)
+        if not base:
+            continue
+        for metric, value in metrics.items():
+            if metric not in base or base[metric] == 0:
+                continue
+            change = (value - base[metric]) / base[metric]
+            worse = -change if METRICS[metric] else change
+            flag = ""
+            if worse > tolerance:
+                flag = "  REGRESSION"
+                regressions += 1
+            print("%-10s %-18s %12.1f -> %12.1f  %+6.1f%%%s" % (
+                name, metric, base[metric], value, change * 100, flag))
+    return regressions
+
+
+def speedups(results, baseline):
+    """How many times better each metric is than in baseline."""
+    factors = {}
+    for name, metrics in results.items():
+        base = baseline.get(name, {})
+        for metric, value in metrics.items():
+            if not base.get(metric) or not value:
+                continue
+            ratio = value / base[metric]
+            factors.setdefault(name, {})[metric] = \
+                ratio if METRICS[metric] else 1 / ratio
+    return factors
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--tsh", default="./tsh_app")
+    parser.add_argument("-n", type=int, default=2000,
+                        help="commands for launch/wide/latency workloads")
+    parser.add_argument("--bytes", default="10G",
+                        help="bytes pushed through each pipeline workload")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--quick", action="store_true",
+                        help="small sizes for a smoke run")
+    parser.add_argument("--only", nargs="*", help="workloads to run")
+    parser.add_argument("--out", default="bench_e2e.json")
+    parser.add_argument("--save-baseline")
+    parser.add_argument("--baseline")
+    parser.add_argument("--tolerance", type=float, default=0.10)
+    parser.add_argument("--speedup-out",
+                        help="with --baseline, write the speedup of each "
+                        "metric over the baseline here")
+    args = parser.parse_args()
+    if args.quick:
+        args.n, args.bytes, args.repeat = 200, "64M", 1
+
+    results = run_all(args)
+    report = {"environment": environment(), "results": results}
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump(report, f, indent=2)
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["results"]
+        regressions = compare(results, baseline, args.tolerance)
+        if args.speedup_out:
+            with open(args.speedup_out, "w") as f:
+                json.dump({"environment": environment(),
+                           "speedup": speedups(results, baseline)},
+                          f, indent=2)
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,102 @@
+#ifndef _ALIAS_H
+#define _ALIAS_H
+
+#include <stdint.h>
+#include <tsh.h>
+
+#include <set>
+#include <string>
+
+using namespace std;
+
+struct Builtin;
+
+// expansions kept before the cache is emptied
+#define DEFINITION_CACHE 1024
+
+/**
+ * @brief Aliases and shell functions.
+ *
+ * `alias NAME=VALUE` makes a command starting with NAME start with VALUE
+ * instead. `NAME() { BODY; }` or `function NAME { BODY; }` defines a
+ * function; calling `NAME ARGS...` runs BODY with $1...$9, $#, $@ and $*
+ * replaced by the arguments and $0 by NAME.
+ *
+ * Both are expanded by parse_input(), not when the command runs: an alias
+ * is spliced into the pipeline, and a call becomes one stage whose body
+ * holds the function's commands (Process::call). The expansion of each
+ * command is cached under its text and the version of the tables, which
+ * every definition bumps, so running the same command again copies the
+ * cached Processes instead of looking up names and parsing the expansion
+ * again. A name is never expanded inside its own expansion, so functions
+ * cannot recurse. Since a line is parsed before it runs, a definition only
+ * applies from the next line on, as bash has it for aliases.
+ *
+ * Every function may be called from any thread.
+ */
+void set_alias(const string &name, const string &value);
+bool remove_alias(const string &name);
+bool get_alias(const string &name, string *value);
+
+void set_function(const string &name, const string &body);
+bool remove_function(const string &name);
+bool get_function(const string &name, string *body);
+
+/**
+ * @brief The version of the alias and function tables, bumped by every
+ * change, so parses made under another version can be told apart.
+ */
+uint64_t definitions_version();
+
+/**
+ * @brief Replaces the aliases and function calls in process_list by their
+ * expansions, leaving the names in expanding alone.
+ */
+void expand_definitions(list<Process *> &process_list,
+                        set<string> &expanding);
+
+/**
+ * @brief parse_input() that leaves the names in expanding unexpanded.
+ */
+void parse_input(char *input_line, list<Process *> &process_list,
+                 set<string> &expanding);
+
+/**
+ * @brief The builtin that runs the call p on a thread of the shell, or null
+ * if a command of its body is not a builtin and it has to run in a child.
+ */
+const Builtin *call_builtin(Process *p);
+
+/**
+ * @brief Runs the body of the call p with the given descriptors.
+ * @return The exit code of its last command.
+ */
+int run_call(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief Takes the alias p defines if it is `alias NAME=VALUE...` (see
+ * builtin_alias()).
+ * @return false if p defines no alias.
+ */
+bool alias_definition(Process *p, string *name, string *value);
+
+/**
+ * @brief The `alias` builtin: `alias NAME=VALUE...` defines an alias, where
+ * VALUE is every word after the '=' with surrounding quotes removed;
+ * `alias NAME` prints one and `alias` all.
+ */
+int builtin_alias(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `unalias` builtin: `unalias NAME...`.
+ */
+int builtin_unalias(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `function` builtin, which runs for a parsed definition: it
+ * stores Process::definition as the body of the function named by its
+ * argument.
+ */
+int builtin_function(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _BUILTINS_H
+#define _BUILTINS_H
+
+#include <tsh.h>
+
+/**
+ * @brief A command implemented inside tsh.
+ *
+ * A builtin reads from in_fd and writes to out_fd and err_fd rather than to
+ * cin/cout, and returns its exit code. Run on its own it runs in the shell
+ * process; as a pipeline stage it runs on a thread of the shell (see
+ * PosixLauncher), so it never blocks the rest of the pipeline and costs no
+ * fork. Since it shares the shell's memory and descriptors it must not exit,
+ * change the working directory or leave descriptors open.
+ */
+typedef int (*builtin_fn)(Process *p, int in_fd, int out_fd, int err_fd);
+
+struct Builtin {
+  const char *name;
+  builtin_fn fn;
+};
+
+/**
+ * @brief Looks up the builtin called name.
+ * @return The builtin, or null if name is not a builtin.
+ */
+const Builtin *find_builtin(const char *name);
+
+/**
+ * @brief The names of every builtin, e.g. for completion.
+ */
+vector<const char *> builtin_names();
+
+/**
+ * @brief Runs p as an external command with the given descriptors and waits
+ * for it, for builtins that leave options they do not handle to the real
+ * program.
+ * @return The command's exit code.
+ */
+int run_external(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief Writes all n bytes of buf, retrying short and interrupted writes.
+ * @return 0, or -1 with errno set.
+ */
+int write_all(int fd, const char *buf, size_t n);
+
+/**
+ * @brief Exit code of a builtin whose output failed with errno err: 141, as
+ * if killed by SIGPIPE, when the reader went away, and 1 otherwise.
+ */
+int write_error_status(int err);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _COMPLETE_H
+#define _COMPLETE_H
+
+#include <forkless.h>
+#include <tsh.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#define COMPLETE_DIR_TTL_MS 2000
+#define COMPLETE_DENTS_BUF (256 * 1024)
+
+/**
+ * @brief Tab completion of command names and paths.
+ *
+ * Command names come from a trie of every file in the $PATH directories (and
+ * the builtins). The trie is built once, lazily, on a background thread by
+ * reading each directory with getdents64; afterwards an inotify watch on the
+ * directories adds and removes names as executables come and go, so nothing
+ * is rescanned per keypress. A change of $PATH rebuilds it.
+ *
+ * Paths are completed from directory listings read with large getdents64
+ * buffers and cached for COMPLETE_DIR_TTL_MS.
+ *
+ * complete() never blocks its caller: the work runs on another thread and
+ * the caller polls the returned future, so a stalled (e.g. NFS) directory
+ * only delays the completion, not the input.
+ */
+class Completer {
+ public:
+  Completer();
+  ~Completer();
+
+  /**
+   * @brief Completes the last word of line.
+   *
+   * The word is completed as a command name when it is the first word of a
+   * pipeline stage and contains no '/', and as a path otherwise.
+   *
+   * @return The candidates, sorted; directories end in '/'.
+   */
+  future<vector<string>> complete(const string &line);
+
+  /**
+   * @brief Command names starting with prefix. Waits for the trie if it is
+   * still being built.
+   */
+  vector<string> complete_command(const string &prefix);
+
+  /**
+   * @brief Paths starting with prefix.
+   */
+  vector<string> complete_path(const string &prefix);
+
+ private:
+  struct Node {
+    // children sorted by byte
+    vector<pair<char, uint32_t>> next;
+    // number of $PATH directories holding this name
+    uint32_t count;
+  };
+  struct Listing {
+    long loaded_ms;
+    // name and whether it is a directory
+    vector<pair<string, bool>> entries;
+  };
+
+  void ensure_trie();
+  void build_trie(const string &path_env);
+  void insert(const char *name, int delta);
+  void collect(uint32_t node, string &prefix, vector<string> &out);
+  void watch();
+  Listing list_dir(const string &dir);
+
+  mutex lock;
+  condition_variable built_cond;
+  // kept out of forked children (see forkless.h)
+  forkless_vector<Node> trie;
+  bool building;
+  bool built;
+  string trie_path;
+
+  int inotify_fd;
+  map<int, string> watches;
+  atomic<bool> stopping;
+  thread builder;
+  thread watcher;
+
+  mutex dir_lock;
+  map<string, Listing> dirs;
+};
+
+/**
+ * @brief The shell's completer, created on first use.
+ */
+Completer *shell_completer();
+
+/**
+ * @brief The `complete` builtin: `complete WORDS...` prints the completions
+ * of the last word of WORDS, one per line.
+ */
+int builtin_complete(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef _EDITOR_H
+#define _EDITOR_H
+
+#include <tsh.h>
+
+#include <future>
+#include <mutex>
+#include <string>
+#include <termios.h>
+
+using namespace std;
+
+#define EDITOR_READ_BUF (64 * 1024)
+#define EDITOR_DEFAULT_COLS 80
+// a lone ESC with nothing after it for this long is the Escape key
+#define EDITOR_ESC_MS 50
+// how often a pending completion is checked
+#define EDITOR_POLL_MS 20
+// keys typed after Tab wait this long for the completion before going on
+#define EDITOR_COMPLETE_WAIT_MS 500
+// typing pause after which the line is handed to speculate()
+#define EDITOR_IDLE_MS 150
+#define EDITOR_MAX_LISTED 100
+
+class Completer;
+class History;
+
+/**
+ * @brief Line editor running the terminal in raw mode.
+ *
+ * Keys (emacs style):
+ *   Left/Right, ^B/^F      move a character   Alt-b/Alt-f  move a word
+ *   Home/End, ^A/^E        start/end of line
+ *   Backspace, Delete, ^D  delete a character (^D on an empty line is EOF)
+ *   ^K ^U ^W Alt-d         kill to end/start/previous word/next word
+ *   ^Y                     yank the last kill; consecutive kills add up
+ *   Up/Down, ^P/^N         history         ^R  reverse incremental search
+ *   Tab                    complete        ^L  clear screen
+ *   ^C                     abandon the line
+ *
+ * The screen is only written by render(), once per batch of input: each
+ * read() takes everything the terminal has sent, all of it is applied to the
+ * line, and then a single write() brings the screen up to date, moving the
+ * cursor only to the first changed cell. The line is shown through a
+ * horizontally scrolling window one screen row wide, so the cost of a
+ * keystroke does not depend on the length of the line and a 100 KB paste is
+ * one read loop and one row of output. Bracketed paste is inserted in bulk;
+ * newlines in pasted text become ';' so each pasted line runs in turn.
+ *
+ * Tab completions run on the completer's threads and are polled. Keys typed
+ * after Tab are held back until the completion lands, so "ls fo<Tab><Enter>"
+ * works, but only for EDITOR_COMPLETE_WAIT_MS: a slow directory never blocks
+ * typing for longer. When the user pauses, the line is passed to
+ * speculate().
+ *
+ * With descriptors that are not a terminal the editor still works, without
+ * changing any terminal mode, which is what the tests use.
+ */
+class LineEditor {
+ public:
+  LineEditor(int in_fd, int out_fd);
+  ~LineEditor();
+
+  /**
+   * @brief Shows prompt and reads one line.
+   * @return false at the end of input.
+   */
+  bool read_line(const string &prompt, string *line);
+
+  /**
+   * @brief Replaces the prompt of the line being edited. May be called from
+   * any thread.
+   */
+  void set_prompt(const string &prompt);
+
+  void set_history(History *history);
+  void set_completer(Completer *completer);
+
+ private:
+  void raw_mode(bool on);
+  bool holding();
+  bool feed();
+  bool key(const string &seq);
+  void insert(const string &text);
+  size_t char_left(size_t from);
+  size_t char_right(size_t from);
+  void kill(size_t from, size_t to);
+  void history_move(int direction);
+  void search(size_t skip);
+  void complete();
+  void finish_completion();
+  size_t word_left(size_t from);
+  size_t word_right(size_t from);
+  void render(bool full, const string &tail = "");
+  void write_all(const string &out);
+
+  int in_fd;
+  int out_fd;
+  bool is_tty;
+  struct termios saved;
+
+  // guards everything below against set_prompt()
+  mutex lock;
+  bool active;
+  string prompt;
+  string buf;
+  size_t pos;
+  string input;
+  bool in_paste;
+  bool eof;
+  string kill_buf;
+  bool last_kill;
+
+  History *history;
+  size_t hist_index;
+  string saved_line;
+
+  bool searching;
+  bool search_failed;
+  string query;
+  size_t search_skip;
+  string match;
+  string before_search;
+
+  Completer *completer;
+  bool completing;
+  future<vector<string>> completion;
+  string completion_line;
+  size_t completion_pos;
+  long completion_ms;
+
+  string speculated;
+
+  // what is on screen
+  string shown_label;
+  string shown_text;
+  size_t shown_col;
+  size_t view_start;
+  size_t cols;
+  bool redraw_full;
+  // written before the next redraw, in the same write()
+  string pending_out;
+};
+
+/**
+ * @brief The shell's line editor, or null when stdin or stdout is not a
+ * terminal or $TERM is "dumb".
+ */
+LineEditor *shell_editor();
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _FILEUTILS_H
+#define _FILEUTILS_H
+
+#include <tsh.h>
+
+// size of the fallback copy buffer; a multiple of the page size
+#define COPY_BUF_SIZE (1 << 20)
+// most the kernel copies in one sendfile/splice/copy_file_range call
+#define COPY_CHUNK 0x7ffff000
+
+/**
+ * @brief Copies everything from in_fd to out_fd without passing it through
+ * user space where the kernel allows it.
+ *
+ * File to file uses copy_file_range (which can share extents or copy on the
+ * server), file to anything else uses sendfile, and a pipe on either side
+ * uses splice. When the kernel refuses (e.g. across file systems, or for a
+ * terminal) the copy goes on through a page-aligned COPY_BUF_SIZE buffer.
+ *
+ * @return 0 on success, -1 with errno set on error (EPIPE when the reader
+ * went away).
+ */
+int copy_fd(int in_fd, int out_fd);
+
+/**
+ * @brief The `cat` builtin: `cat [FILE...]`, where "-" (or no file) is
+ * stdin. Options are left to the real cat.
+ */
+int builtin_cat(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `cp` builtin: `cp SOURCE DEST` or `cp SOURCE... DIRECTORY`.
+ * Options are left to the real cp.
+ */
+int builtin_cp(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
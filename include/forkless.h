@@ -0,0 +1,92 @@
+#ifndef _FORKLESS_H
+#define _FORKLESS_H
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// smaller allocations stay on the heap
+#define FORKLESS_MIN_BYTES (64 * 1024)
+
+/**
+ * @brief Allocates size bytes in a mapping of their own that fork() leaves
+ * out of the child (MADV_DONTFORK).
+ *
+ * fork() copies the page tables of every private mapping, so each large
+ * cache the shell keeps (the history index, the completion trie, sort
+ * arenas) makes every command it launches slower. Memory from here is
+ * simply absent in the child, which is fine because a forked child only
+ * execs. Nothing a child touches between fork and exec may live here.
+ *
+ * @return The memory, zero-filled, or null if it could not be mapped.
+ */
+void *forkless_alloc(size_t size);
+
+/**
+ * @brief Frees memory from forkless_alloc() of the same size.
+ */
+void forkless_free(void *p, size_t size);
+
+/**
+ * @brief Gives the heap's free memory back to the kernel (malloc_trim), so
+ * it is not mapped, and copied, at the next fork.
+ */
+void trim_heap();
+
+/**
+ * @brief An allocator that puts allocations of FORKLESS_MIN_BYTES or more
+ * in forkless_alloc() mappings, e.g. for the storage of a big vector.
+ */
+template <class T>
+struct ForklessAllocator {
+  typedef T value_type;
+
+  ForklessAllocator() {}
+  template <class U>
+  ForklessAllocator(const ForklessAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    size_t size = n * sizeof(T);
+    if (size < FORKLESS_MIN_BYTES) return allocator<T>().allocate(n);
+    T *p = (T *)forkless_alloc(size);
+    if (!p) throw bad_alloc();
+    return p;
+  }
+
+  void deallocate(T *p, size_t n) {
+    size_t size = n * sizeof(T);
+    if (size < FORKLESS_MIN_BYTES) {
+      allocator<T>().deallocate(p, n);
+    } else {
+      forkless_free(p, size);
+    }
+  }
+
+  template <class U>
+  bool operator==(const ForklessAllocator<U> &) const {
+    return true;
+  }
+  template <class U>
+  bool operator!=(const ForklessAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <class T>
+using forkless_vector = vector<T, ForklessAllocator<T>>;
+
+/**
+ * @brief Deleter for a unique_ptr owning a forkless_alloc() block.
+ */
+struct ForklessFree {
+  size_t size;
+  void operator()(char *p) const { forkless_free(p, size); }
+};
+
+typedef unique_ptr<char[], ForklessFree> forkless_block;
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _GREP_H
+#define _GREP_H
+
+#include <tsh.h>
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+#define GREP_BUF_SIZE (1 << 20)
+#define GREP_OUT_FLUSH (1 << 20)
+#define TEDDY_BUCKETS 8
+
+/**
+ * @brief Finds the first occurrence of any of a set of fixed strings.
+ *
+ * One pattern is searched with a pair prefilter: each 32 (AVX2) or 16
+ * (SSE2) positions are tested at once for the pattern's first and last
+ * byte, and only positions where both match are compared in full.
+ *
+ * Several patterns use a Teddy-style prefilter: the patterns are spread
+ * over TEDDY_BUCKETS buckets, and for the first one or two bytes of every
+ * bucket a pair of 16-entry tables maps the low and high nibble of an input
+ * byte to the buckets that byte could start. pshufb looks up a whole vector
+ * of input bytes at once, and only positions whose buckets survive the AND
+ * of all lookups are verified against that bucket's patterns. Without
+ * SSSE3 the same tables are used one byte at a time.
+ */
+class FixedMatcher {
+ public:
+  explicit FixedMatcher(const vector<string> &patterns);
+
+  /**
+   * @brief Offset of the first match in buf[0, n), or n if there is none.
+   */
+  size_t find(const char *buf, size_t n) const;
+
+ private:
+  bool verify(const char *buf, size_t n, size_t at, uint8_t buckets) const;
+
+  vector<string> patterns;
+  // ids of the patterns in each bucket
+  vector<int> buckets[TEDDY_BUCKETS];
+  // an empty pattern matches everywhere
+  bool match_all;
+  // prefix bytes covered by the tables: 1 or 2
+  int fingerprint;
+  // low and high nibble tables for each fingerprint byte
+  alignas(16) uint8_t tables[4][16];
+};
+
+/**
+ * @brief The `grep` builtin for fixed strings:
+ * `grep [-F] [-v] [-c] [-n] [-q] [-e PATTERN]... [PATTERN] [FILE...]`.
+ *
+ * Without -F the patterns must not use any regular expression syntax. Other
+ * options and regular expressions are left to the real grep.
+ */
+int builtin_grep(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
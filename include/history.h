@@ -0,0 +1,109 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <forkless.h>
+#include <tsh.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#define HISTORY_MAX_ENTRIES 1000000
+#define HISTORY_INDEX_BITS 18
+
+/**
+ * @brief Command history shared by every tsh session of a user.
+ *
+ * The history file holds one entry per line, oldest first. Entries are only
+ * ever appended, each with a single write() on an O_APPEND descriptor, so
+ * concurrent sessions never interleave or lose entries.
+ *
+ * At startup the file is mmap'd and nothing else is done: recent entries are
+ * found on demand by scanning backwards from the end. A background thread
+ * then builds a trigram index for search() and, if the file holds more than
+ * max_entries entries, compacts it: duplicates are dropped (keeping the
+ * newest) and only the newest max_entries are kept. Compaction and appends
+ * are serialised through flock on "<file>.lock".
+ *
+ * Entries added during this session are kept in memory on top of the mapped
+ * snapshot; entries other sessions add show up in the next session.
+ */
+class History {
+ public:
+  History(const string &path, size_t max_entries = HISTORY_MAX_ENTRIES);
+  ~History();
+
+  /**
+   * @brief Appends line to the history and to the file.
+   */
+  void add(const char *line);
+
+  /**
+   * @brief Fetches the k-th newest entry (k = 0 is the newest).
+   * @return false if there are fewer than k + 1 entries.
+   */
+  bool recent(size_t k, string *out);
+
+  /**
+   * @brief Finds entries containing pattern, newest first, without
+   * duplicates.
+   */
+  vector<string> search(const char *pattern, size_t limit);
+
+  /**
+   * @brief Waits for the background index build and compaction to finish.
+   */
+  void sync();
+
+ private:
+  void maintain();
+  void build_index();
+  void compact();
+  bool reopen_if_replaced();
+  string mapped_entry(size_t start, size_t end);
+
+  string path;
+  size_t max_entries;
+  int fd;
+  int lock_fd;
+
+  // read-only snapshot of the file taken at startup
+  char *map;
+  size_t map_len;
+  // entry start offsets found by scanning back from the end, newest first
+  vector<size_t> tail;
+
+  // entry start offsets of the whole snapshot, oldest first, and the
+  // trigram index over them; both are valid once index_ready is set. The
+  // postings of bucket b are postings[bucket_start[b], bucket_start[b + 1]).
+  // They are kept out of forked children (see forkless.h).
+  forkless_vector<size_t> offsets;
+  forkless_vector<uint8_t> postings;
+  forkless_vector<size_t> bucket_start;
+  forkless_vector<uint32_t> counts;
+  atomic<bool> index_ready;
+
+  vector<string> added;
+  mutex lock;
+  atomic<bool> stopping;
+  thread maintenance;
+};
+
+/**
+ * @brief The history of the interactive shell, or null when tsh is not
+ * interactive.
+ */
+History *shell_history();
+
+/**
+ * @brief The `history` builtin.
+ *
+ * `history [N]` prints the last N (default all) entries, oldest first;
+ * `history -s PATTERN` prints entries containing PATTERN, newest first.
+ */
+int builtin_history(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef _LAUNCHER_H
+#define _LAUNCHER_H
+
+#include <tsh.h>
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+struct Builtin;
+
+// builtin jobs a PosixLauncher keeps on threads; more run in children
+#define BUILTIN_THREADS 64
+
+/**
+ * @brief The system calls run_commands() needs to start a pipeline.
+ *
+ * run_commands() only talks to processes through this interface, so the
+ * scheduling logic can run against real processes (PosixLauncher) or against
+ * simulated ones (FakeLauncher) in tests and benchmarks.
+ *
+ * A job is identified by the pid_t returned from launch(). Wait statuses use
+ * the usual waitpid() encoding, so WIFEXITED/WEXITSTATUS apply.
+ */
+class ProcessLauncher {
+ public:
+  virtual ~ProcessLauncher() {}
+
+  /**
+   * @brief Creates a pipe. fd[0] is the read end and fd[1] the write end.
+   * @return 0 on success, -1 on error.
+   */
+  virtual int make_pipe(int fd[2]) = 0;
+
+  /**
+   * @brief Starts a job running p.
+   *
+   * @param in_fd Descriptor to use as the job's stdin, or -1 to inherit.
+   * @param out_fd Descriptor to use as the job's stdout, or -1 to inherit.
+   * @param err_fd Descriptor to use as the job's stderr, or -1 to inherit.
+   * @return The job's id, or -1 if it could not be started.
+   */
+  virtual pid_t launch(Process *p, int in_fd, int out_fd, int err_fd) = 0;
+
+  /**
+   * @brief Closes a descriptor returned by make_pipe().
+   */
+  virtual void close_fd(int fd) = 0;
+
+  /**
+   * @brief Waits for a job started by launch() to finish.
+   * @return The job's wait status.
+   */
+  virtual int wait_job(pid_t job) = 0;
+};
+
+/**
+ * @brief Launches real processes with pipe, fork, dup2, execvp and waitpid.
+ *
+ * Pipes are created close-on-exec, so a child only keeps the two ends dup2'd
+ * onto its stdin and stdout.
+ *
+ * Builtins are not forked: each runs on a thread of its own with private
+ * copies of its descriptors, and its job id is negative, unless
+ * BUILTIN_THREADS of them are still to be waited for. One instance may be
+ * used by several threads at once.
+ */
+class PosixLauncher : public ProcessLauncher {
+ public:
+  PosixLauncher();
+
+  int make_pipe(int fd[2]) override;
+  pid_t launch(Process *p, int in_fd, int out_fd, int err_fd) override;
+  void close_fd(int fd) override;
+  int wait_job(pid_t job) override;
+
+ private:
+  pid_t fork_builtin(Process *p, const Builtin *builtin, int in_fd,
+                     int out_fd, int err_fd, int cpu);
+  // builtin jobs not waited for yet
+  size_t thread_jobs();
+
+  mutex lock;
+  // builtin jobs, each yielding its wait status
+  map<pid_t, future<int>> threads;
+  pid_t next_thread;
+};
+
+/**
+ * @brief Simulates processes without creating any.
+ *
+ * Each command name can be given a program: how long it runs (on a virtual
+ * clock), what it writes and its exit status. A passthrough program first
+ * copies its stdin to its stdout, like cat. Commands without a program fail
+ * immediately with status 127, as if execvp had failed.
+ *
+ * Jobs start at the current virtual time and waiting for a job advances the
+ * clock to its end time, so a pipeline costs the time of its slowest stage
+ * and a ';' list costs the sum of its pipelines. Output that does not go to
+ * a pipe is appended to stdout_data.
+ */
+class FakeLauncher : public ProcessLauncher {
+ public:
+  struct Program {
+    long duration_ns;
+    string output;
+    int status;
+    bool passthrough;
+  };
+
+  FakeLauncher();
+
+  void set_program(const string &name, long duration_ns,
+                   const string &output = "", int status = 0,
+                   bool passthrough = false);
+
+  int make_pipe(int fd[2]) override;
+  pid_t launch(Process *p, int in_fd, int out_fd, int err_fd) override;
+  void close_fd(int fd) override;
+  int wait_job(pid_t job) override;
+
+  // virtual time in nanoseconds
+  long now_ns;
+  // everything written to the simulated stdout
+  string stdout_data;
+  // number of jobs launched so far
+  size_t launched;
+  // number of pipe descriptors currently open
+  size_t open_fds;
+
+ private:
+  struct Job {
+    long end_ns;
+    int status;
+  };
+
+  map<string, Program> programs;
+  map<pid_t, Job> jobs;
+  map<int, shared_ptr<string>> pipes;
+  pid_t next_job;
+  int next_fd;
+};
+
+#endif
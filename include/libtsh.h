@@ -0,0 +1,87 @@
+#ifndef _LIBTSH_H
+#define _LIBTSH_H
+
+#include <tsh.h>
+
+#include <functional>
+#include <future>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief A parsed command line that can be run any number of times.
+ *
+ * This is the embeddable entry point of libtsh.a: a service parses a command
+ * string once and then runs it directly, instead of paying for a /bin/sh per
+ * call through system() or popen(). The line may contain pipes and ';' lists
+ * exactly as typed at the tsh prompt.
+ *
+ * Runs never modify the Pipeline, so one Pipeline may be run from several
+ * threads at the same time. Every run returns the exit code of the last
+ * stage (see exit_code()).
+ *
+ * Example:
+ * @code
+ *   Pipeline grep("grep -c error");
+ *   string out;
+ *   int status = grep.run(log_text, &out);
+ * @endcode
+ */
+class Pipeline {
+ public:
+  explicit Pipeline(const char *cmd);
+  ~Pipeline();
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  /**
+   * @brief Runs the pipeline on caller-supplied descriptors.
+   *
+   * @param in_fd stdin of the first stage, or -1 to inherit the caller's.
+   * @param out_fd stdout of the last stage, or -1 to inherit the caller's.
+   * @param err_fd stderr of every stage, or -1 to inherit the caller's.
+   * @return The exit code of the last stage.
+   */
+  int run(int in_fd = -1, int out_fd = -1, int err_fd = -1) const;
+
+  /**
+   * @brief Runs the pipeline with in-memory stdin and stdout.
+   *
+   * @param input Bytes fed to the first stage's stdin.
+   * @param output If not null, receives everything the last stage wrote to
+   * stdout; otherwise that output is discarded.
+   * @return The exit code of the last stage.
+   */
+  int run(const string &input, string *output) const;
+
+  /**
+   * @brief Like run(in_fd, out_fd, err_fd), on a separate thread.
+   */
+  future<int> run_async(int in_fd = -1, int out_fd = -1,
+                        int err_fd = -1) const;
+
+  /**
+   * @brief Like run(input, output), on a separate thread. output must stay
+   * valid until the future is ready.
+   */
+  future<int> run_async(const string &input, string *output) const;
+
+  /**
+   * @brief Runs the pipeline on a separate thread and calls done with the
+   * exit code when it finishes.
+   */
+  void run_async(function<void(int)> done, int in_fd = -1, int out_fd = -1,
+                 int err_fd = -1) const;
+
+  /**
+   * @brief Number of stages across the whole line.
+   */
+  size_t size() const { return process_list.size(); }
+
+ private:
+  list<Process *> process_list;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _LINEREAD_H
+#define _LINEREAD_H
+
+#include <tsh.h>
+
+#include <mutex>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+// bytes read at a time from input that can be given back
+#define LINE_READ_BLOCK (64 * 1024)
+
+struct LineBuffer {
+  mutex lock;
+  vector<char> data;
+  // unread bytes are data[at, have)
+  size_t at = 0, have = 0;
+  bool eof = false;
+};
+
+/**
+ * @brief Reads lines from a descriptor without consuming input that is not
+ * returned, so other commands reading the same input continue where the
+ * lines ended.
+ *
+ * Shells read pipes one byte at a time for this. A LineReader reads
+ * LINE_READ_BLOCK bytes at a time instead whenever it can give back what it
+ * read too far:
+ * - a seekable input is read in blocks and the unread part is handed back
+ *   with lseek by release(), or by lend() for the time another command reads
+ *   the descriptor;
+ * - a pipe is read in blocks while a reader that owns it is alive, which
+ *   only a pipeline stage that has the pipe to itself may be, and every
+ *   LineReader on that pipe, through any descriptor, shares the owner's
+ *   buffer;
+ * - any other input is read a byte at a time.
+ */
+class LineReader {
+ public:
+  /**
+   * @param own Take ownership of the pipe fd is reading, if it is one that
+   * nobody owns yet.
+   */
+  explicit LineReader(int fd, bool own = false);
+  ~LineReader();
+
+  LineReader(const LineReader &) = delete;
+  LineReader &operator=(const LineReader &) = delete;
+
+  /**
+   * @brief Reads the next line, without its newline, into line.
+   * @return true if a whole line was read; false at the end of the input,
+   * with line holding an unterminated last line if there was one, or on an
+   * error, with errno set.
+   */
+  bool read_line(string *line);
+
+  /**
+   * @brief Gives the input read beyond the returned lines back to the
+   * descriptor.
+   */
+  void release();
+
+  /**
+   * @brief Like release(), but keeps the buffer for reclaim().
+   */
+  void lend();
+
+  /**
+   * @brief Resumes after lend(): if nothing read the descriptor meanwhile
+   * the buffer is used again, otherwise reading continues from where the
+   * other reader stopped.
+   */
+  void reclaim();
+
+ private:
+  int fd;
+  bool seekable;
+  // read whole blocks: seekable, or a pipe with an owner
+  bool blocks;
+  LineBuffer local;
+  LineBuffer *buffer;
+  // the owned pipe, identified by device and inode
+  bool owner;
+  pair<dev_t, ino_t> pipe_id;
+  // offset handed back by lend(), or -1
+  off_t lent_at;
+};
+
+/**
+ * @brief The `read` builtin: `read [-r] [NAME...]`.
+ *
+ * Reads one line and splits it on blanks into the shell variables NAME
+ * (see variables.h); the last NAME gets the rest of the line. Without NAME
+ * the whole line goes to REPLY. Without -r a backslash escapes the next
+ * character and a backslash at the end of the line continues it on the next
+ * line.
+ *
+ * @return 0, or 1 at the end of the input.
+ */
+int builtin_read(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `mapfile` builtin: `mapfile [-t] [-n COUNT] [-s SKIP] [NAME]`.
+ *
+ * Reads lines into the array NAME, or MAPFILE: at most COUNT lines, after
+ * discarding SKIP. With -t the newlines are removed.
+ */
+int builtin_mapfile(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief Runs a `while read [-r] [NAME...]; do BODY; done` loop.
+ *
+ * parse_input() compiles the loop into one Process: its tokens are the
+ * read command and its body holds BODY's commands, parsed once. The loop
+ * runs the body through run_commands() for every line, with the loop's
+ * descriptors. As a pipeline stage it owns its input pipe, so it reads it in
+ * blocks and the body's own `read` commands share the loop's buffer. Only
+ * `read` conditions are supported.
+ *
+ * @return The exit code of the body's last command, or 0 if it never ran.
+ */
+int builtin_while(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Resolves a command name to the executable execvp would run.
+ *
+ * Results are cached per name, so the $PATH directories are only searched
+ * the first time a command is used. The cache is dropped whenever $PATH
+ * changes. Names containing a '/' are not looked up. Safe to call from
+ * several threads.
+ *
+ * @return The full path of the executable, or "" if none was found.
+ */
+string path_lookup(const char *name);
+
+/**
+ * @brief Forgets every cached lookup, e.g. after an executable moved.
+ */
+void path_cache_clear();
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _PROMPT_H
+#define _PROMPT_H
+
+#include <tsh.h>
+
+#include <string>
+
+using namespace std;
+
+#define PROMPT_DEFAULT "$ "
+#define PROMPT_GIT_TIMEOUT_MS 2000
+
+/**
+ * @brief PS1-style prompt rendering.
+ *
+ * The prompt format is taken from $TSH_PS1 (default "$ ") and understands:
+ *   \w  current directory, with $HOME shown as ~
+ *   \W  last component of the current directory
+ *   \u  user name          \h  host name up to the first '.'
+ *   \?  exit code of the last command
+ *   \d  duration of the last command (e.g. 35ms, 1.2s)
+ *   \j  number of background jobs (tsh has none yet, so always 0)
+ *   \g  git branch, with a '*' when the work tree is dirty
+ *   \$  '#' for root, '$' otherwise
+ *   \e  escape character, for colours     \\  a backslash
+ *
+ * Rendering never waits. The git branch is read from .git/HEAD directly; the
+ * dirty state needs `git status`, which runs on a worker thread with a
+ * PROMPT_GIT_TIMEOUT_MS timeout, and until it answers the last known state
+ * of that repository is shown. When a fresh state arrives while the prompt
+ * is still waiting for input, the prompt is patched in place through the
+ * redraw hook.
+ */
+string render_prompt(const char *format);
+
+/**
+ * @brief The prompt format currently in effect.
+ */
+const char *prompt_format();
+
+/**
+ * @brief Records the exit code and duration of the command that just ran.
+ */
+void prompt_command_done(int status, long duration_ms);
+
+/**
+ * @brief Records that prompt is on screen waiting for input. Patches are
+ * only drawn between this and prompt_done().
+ */
+void prompt_drawn(const string &prompt);
+
+/**
+ * @brief Records that the input line was read and the prompt is no longer
+ * live.
+ */
+void prompt_done();
+
+/**
+ * @brief Sets how a changed prompt is drawn while the user is typing. The
+ * default rewrites the prompt in place, keeping the cursor, but only when
+ * its width did not change, since the typed text cannot be redrawn.
+ */
+void prompt_set_redraw(void (*redraw)(const string &prompt));
+
+/**
+ * @brief Visible width of a rendered prompt, skipping escape sequences.
+ */
+size_t prompt_width(const string &prompt);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _QOS_H
+#define _QOS_H
+
+#include <tsh.h>
+
+// nice values of the demoted classes
+#define QOS_BATCH_NICE 10
+#define QOS_IDLE_NICE 19
+// best-effort I/O priority of the batch class, from 0 (high) to 7 (low)
+#define QOS_BATCH_IOPRIO 7
+
+/**
+ * @brief How much a pipeline may take from other work on the host.
+ *
+ * A line starting with `qos CLASS` runs the pipeline that follows in that
+ * class, e.g. `qos idle tar c src | gzip | wc -c`:
+ * - normal: as the shell itself runs;
+ * - batch: nice QOS_BATCH_NICE, best-effort I/O priority QOS_BATCH_IOPRIO
+ *   and SCHED_BATCH, so it keeps running but loses every contest for the
+ *   cpu or disk against interactive work;
+ * - idle: nice QOS_IDLE_NICE, the idle I/O class and SCHED_IDLE, so it only
+ *   runs on otherwise idle cpus and disks.
+ * Every stage gets the class before it runs, in the child before exec or on
+ * the builtin's thread, and everything it starts inherits it.
+ */
+enum QosClass { QOS_NORMAL, QOS_BATCH, QOS_IDLE };
+
+/**
+ * @brief Looks up a class by name.
+ * @return false if name is not a class.
+ */
+bool parse_qos(const char *name, QosClass *qos);
+
+/**
+ * @brief Moves the calling thread, or a freshly forked child, into qos. A
+ * class never raises the priority it finds: a nice value already above the
+ * class's is kept.
+ * @return 0, or -1 with errno set if a setting was refused.
+ */
+int apply_qos(QosClass qos);
+
+/**
+ * @brief The `qos` builtin, which only runs when a `qos` prefix could not
+ * be taken off a line: it reports the usage.
+ */
+int builtin_qos(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _RC_H
+#define _RC_H
+
+#include <stdint.h>
+
+#include <string>
+
+using namespace std;
+
+#define RC_SNAPSHOT_MAGIC "tshrc\0\0\1"
+#define RC_SNAPSHOT_MAGIC_LEN 8
+
+/**
+ * @brief How load_rc() brought in the startup file.
+ */
+enum RcLoad {
+  RC_NONE,      // there is no startup file
+  RC_RAN,       // it runs commands, so it ran line by line
+  RC_COMPILED,  // it was parsed and its snapshot written
+  RC_MAPPED,    // its snapshot was mapped; nothing was parsed
+};
+
+/**
+ * @brief Reads the startup file into the shell.
+ *
+ * The startup file is $TSH_RC, or ~/.tshrc if TSH_RC is not set; an empty
+ * TSH_RC means none. It holds command lines; blank lines and lines starting
+ * with '#' are skipped.
+ *
+ * A file that only defines things (`NAME=VALUE`, `export`, `unset`,
+ * `alias`, `unalias` and functions) is parsed once into a snapshot: a flat
+ * file of records holding the name and the still unexpanded value, alias or
+ * function body of each definition. The snapshot is named
+ * after the FNV-1a hash of the file's contents and kept in
+ * $XDG_CACHE_HOME/tsh (or ~/.cache/tsh), so an edited file gets a new one
+ * and the old one is removed. At the next startup the snapshot is mapped and
+ * its records applied in order, which skips the parser; values are expanded
+ * as they are applied, so `export PATH=$HOME/bin:$PATH` still sees the
+ * environment the shell started with.
+ *
+ * Any other command has effects a snapshot cannot replay, so a file with one
+ * runs line by line every time, as the shell would run it.
+ */
+RcLoad load_rc();
+
+/**
+ * @brief load_rc() for the startup file at path, with the snapshot kept in
+ * cache_dir.
+ */
+RcLoad load_rc(const string &path, const string &cache_dir);
+
+/**
+ * @brief The FNV-1a hash of size bytes at data, which names a snapshot.
+ */
+uint64_t rc_hash(const char *data, size_t size);
+
+#endif
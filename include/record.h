@@ -0,0 +1,108 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#define RECORD_MAGIC "TSHREC1"
+#define RECORD_MAGIC_LEN 7
+// variables saved with a session; they change what its commands do or how
+// fast they run
+#define RECORD_ENV                                                      \
+  {"PATH", "HOME", "LANG", "LC_ALL", "LC_COLLATE", "TMPDIR", "TSH_RC", \
+   "TSH_AFFINITY"}
+// commands tsh_replay lists as slowed down the most
+#define REPLAY_SLOWEST 5
+
+/**
+ * @brief Session recording (`tsh_app --record FILE`).
+ *
+ * Every command line the shell runs is appended to FILE together with its
+ * start time, duration and exit status, the working directory and the
+ * RECORD_ENV variables, so that tsh_replay can later run the same traffic
+ * again.
+ *
+ * The file is a stream of records, each written with one write() to the
+ * file opened O_APPEND, so any number of shells can record into one file.
+ * Every record starts with a tag byte and the id of its session, and
+ * numbers are varints:
+ * - 'S' id start: a session began at start (ns since the epoch);
+ * - 'D' id dir: the working directory is now dir;
+ * - 'E' id n (name value)*n: the RECORD_ENV variables are now these;
+ * - 'C' id delta duration status line: a command started delta ns after
+ *   the previous one (or the session start) and took duration ns.
+ * A string is its varint length and its bytes. 'D' and 'E' are only written
+ * when they change, so a command usually costs a dozen bytes plus its line.
+ */
+class SessionRecorder {
+ public:
+  explicit SessionRecorder(const string &path);
+  ~SessionRecorder();
+
+  /**
+   * @brief Whether the file could be opened.
+   */
+  bool ok() const { return fd != -1; }
+
+  /**
+   * @brief Appends one command.
+   *
+   * @param start_ns When it started, in ns since the epoch.
+   */
+  void record(const string &line, uint64_t start_ns, uint64_t duration_ns,
+              int status);
+
+ private:
+  int fd;
+  uint64_t id;
+  uint64_t last_start_ns;
+  string cwd;
+  vector<pair<string, string>> env;
+};
+
+/**
+ * @brief Starts recording the shell's commands into path.
+ * @return false if path could not be opened.
+ */
+bool start_recording(const string &path);
+
+/**
+ * @brief The recorder start_recording() set up, or null.
+ */
+SessionRecorder *session_recorder();
+
+struct RecordedCommand {
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  int status;
+  string line;
+  string cwd;
+  // index into RecordedSession::envs
+  size_t env;
+};
+
+struct RecordedSession {
+  uint64_t id;
+  uint64_t start_ns;
+  // the working directory and variables at the start
+  string cwd;
+  vector<vector<pair<string, string>>> envs;
+  vector<RecordedCommand> commands;
+};
+
+/**
+ * @brief Reads every session of a recording, in the order they started.
+ *
+ * A record cut short at the end of the file, as a shell killed while
+ * writing leaves it, is ignored.
+ *
+ * @return false if path cannot be read or is not a recording.
+ */
+bool read_recording(const string &path, vector<RecordedSession> *sessions);
+
+#endif
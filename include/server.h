@@ -0,0 +1,46 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <tsh.h>
+
+/**
+ * @brief Command server mode (`tsh_app --serve SOCKET`).
+ *
+ * Clients connect to a Unix domain stream socket and send one command line
+ * per request, terminated by '\n'. A request may carry three descriptors
+ * (stdin, stdout, stderr) as SCM_RIGHTS ancillary data; such a request must
+ * be sent with a single sendmsg() holding just that one line.
+ *
+ * Every request is answered with a header line "<exit code> <n>\n" followed
+ * by n bytes of output. When descriptors were passed the command writes to
+ * them directly and n is 0; otherwise it runs with empty stdin and n bytes
+ * of captured stdout.
+ *
+ * Requests of one client run in order; requests of different clients run
+ * concurrently on a pool of worker threads. All clients share the PATH cache,
+ * the parse cache and the launcher. A "quit" request closes the client's
+ * session.
+ */
+
+#define SERVE_WORKERS 32
+#define SERVE_PARSE_CACHE 4096
+
+int serve(const char *socket_path);
+
+/**
+ * @brief Sends one request over a connected server socket.
+ *
+ * @param fds stdin, stdout and stderr to pass along, or null to pass none.
+ * @return 0 on success, -1 on error.
+ */
+int send_request(int sock, const char *line, const int *fds);
+
+/**
+ * @brief Reads the reply to one request.
+ *
+ * @param output If not null, receives the reply's output bytes.
+ * @return The command's exit code, or -1 if the server hung up.
+ */
+int read_reply(int sock, string *output);
+
+#endif
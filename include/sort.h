@@ -0,0 +1,36 @@
+#ifndef _SORT_H
+#define _SORT_H
+
+#include <tsh.h>
+
+// memory for lines before sorted runs are spilled to temporary files
+#define SORT_MEMORY_BUDGET (256L << 20)
+// lines are read straight into arena blocks of this size
+#define SORT_ARENA_BLOCK (16 << 20)
+// buffer for each spilled run while merging, and for the output
+#define SORT_IO_BUF (1 << 20)
+// fewer lines than this per thread are not worth another thread
+#define SORT_MIN_PER_THREAD 16384
+
+/**
+ * @brief The `sort` builtin:
+ * `sort [-unr] [-t SEP] [-k FIELD[,FIELD]] [-S SIZE] [FILE...]`.
+ *
+ * Input is read directly into large arena blocks and described by compact
+ * line records holding the first 8 bytes of the key, so most comparisons
+ * never touch the lines themselves. The records are cut into one chunk per
+ * core and the chunks are sorted in parallel.
+ *
+ * Once the arena and records exceed the memory budget (-S, default
+ * SORT_MEMORY_BUDGET) the sorted records are merged into a run in an
+ * unlinked temporary file in $TMPDIR and the arena is reused. The output is
+ * a k-way merge of the runs and of the chunks still in memory, so equal
+ * lines keep their input order and -u keeps the first of them.
+ *
+ * Lines compare as bytes, which is what sort does under LC_ALL=C; with
+ * another collation in the environment, or any other option, the real sort
+ * is run instead.
+ */
+int builtin_sort(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _SPECULATE_H
+#define _SPECULATE_H
+
+#include <tsh.h>
+
+/**
+ * @brief Speculative preparation of the line being typed.
+ *
+ * The line editor calls speculate() with the partial line whenever it is
+ * idle between keystrokes. A worker thread then parses the line, resolves
+ * each command through the PATH cache, and asks the kernel to read the
+ * executables and the files named after '<' into the page cache
+ * (posix_fadvise WILLNEED plus readahead), so binaries on cold storage are
+ * already cached when Enter is pressed.
+ *
+ * The parse of the last speculated line is kept; if Enter submits exactly
+ * that line, take_speculation() hands it over so run() skips parse_input().
+ */
+void speculate(const char *partial_line);
+
+/**
+ * @brief Takes the speculative parse of line, if there is one.
+ *
+ * Waits if the worker is still preparing exactly this line.
+ *
+ * @return true if process_list was filled; otherwise the caller parses the
+ * line itself.
+ */
+bool take_speculation(const char *line, list<Process *> &process_list);
+
+#endif
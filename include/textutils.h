@@ -0,0 +1,52 @@
+#ifndef _TEXTUTILS_H
+#define _TEXTUTILS_H
+
+#include <tsh.h>
+
+// read size for the counting builtins
+#define TEXT_BUF_SIZE (1 << 20)
+// head usually needs little of its input, so it reads less at a time
+#define HEAD_BUF_SIZE (128 * 1024)
+// tail reads regular files backwards in blocks of this size
+#define TAIL_BLOCK_SIZE (64 * 1024)
+
+/**
+ * @brief Counts the bytes equal to c in buf[0, n).
+ *
+ * Compares 32 bytes per instruction with AVX2 or 16 with SSE2, whichever the
+ * CPU supports, accumulating per-byte counters that are summed every 255
+ * iterations; other architectures use a scalar loop.
+ */
+size_t count_byte(const char *buf, size_t n, char c);
+
+/**
+ * @brief The `echo` builtin: `echo [-n] [ARG...]`. -e and -E are left to the
+ * real echo.
+ */
+int builtin_echo(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `wc` builtin: `wc [-lwc] [FILE...]`. Other options are left to
+ * the real wc.
+ */
+int builtin_wc(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `head` builtin: `head [-n N | -N | -c N] [FILE]`.
+ *
+ * It stops reading as soon as it has written its output and returns, which
+ * closes its end of the pipe so the stages before it get EPIPE and stop. On
+ * a seekable input the part read beyond the output is given back with lseek.
+ */
+int builtin_head(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `tail` builtin: `tail [-n N | -N | -c N] [FILE]`.
+ *
+ * A regular file is read backwards from its end, so the cost does not
+ * depend on its size, and the tail is then copied with copy_fd(). Other
+ * input is read to the end keeping only the blocks that may hold the tail.
+ */
+int builtin_tail(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
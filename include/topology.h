@@ -0,0 +1,94 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <tsh.h>
+
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// where read_cpu_topology() looks for the cpu and node directories
+#define SYSFS_SYSTEM "/sys/devices/system"
+
+/**
+ * @brief Where a cpu sits: its NUMA node and the caches it shares. A cache
+ * is identified by the lowest cpu sharing it.
+ */
+struct CpuInfo {
+  int cpu;
+  int node;
+  int l3;
+  int l2;
+};
+
+/**
+ * @brief Parses a sysfs cpu list such as "0-3,8,10-11".
+ */
+vector<int> parse_cpu_list(const string &text);
+
+/**
+ * @brief Reads the node, L2 and L3 of every cpu this process may run on
+ * from sysfs. Missing information is filled in conservatively: without an
+ * L3 the node stands in for it, without an L2 every cpu has its own.
+ */
+vector<CpuInfo> read_cpu_topology(const string &root = SYSFS_SYSTEM);
+
+/**
+ * @brief Picks the cpu each pipeline stage is pinned to.
+ *
+ * The cpus are ordered by node, then L3, then L2, so neighbours in the
+ * order share the closest cache there is. Each L3 (within a node) is a
+ * domain. A pipeline stays in one domain and its stages take consecutive
+ * cpus, so a stage and the next one share an L2 when they can and an L3
+ * otherwise; a pipeline longer than its domain wraps around inside it.
+ *
+ * Successive pipelines start in the domains in turn, alternating between
+ * nodes, so independent jobs spread over the machine. Thread-safe.
+ */
+class CpuPlacer {
+ public:
+  explicit CpuPlacer(vector<CpuInfo> cpus);
+
+  /**
+   * @brief The cpu for the first stage of a new pipeline, or -1 if there
+   * is nothing to choose from.
+   */
+  int first_stage();
+
+  /**
+   * @brief The cpu for the stage after the one placed on cpu.
+   */
+  int next_stage(int cpu);
+
+ private:
+  struct Domain {
+    size_t begin, end;
+    // where its next pipeline starts
+    size_t next;
+  };
+
+  mutex lock;
+  vector<CpuInfo> cpus;
+  vector<Domain> domains;
+  // domain of each entry of cpus
+  vector<size_t> domain_of;
+  size_t next_domain;
+};
+
+/**
+ * @brief The cpu to pin a new pipeline stage to, or -1 not to pin it.
+ *
+ * Placement is off unless $TSH_AFFINITY is "cache"; then the shell's
+ * CpuPlacer, built from sysfs on first use, is asked. Call it on the thread
+ * launching the pipeline, once per stage in order: first is true for the
+ * first stage.
+ */
+int place_stage(bool first);
+
+/**
+ * @brief Pins the calling thread, or a freshly forked child, to cpu.
+ */
+void pin_to_cpu(int cpu);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef _SIMPLE_SHELL_H
 #define _SIMPLE_SHELL_H
 
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,11 +11,15 @@
 #include <unistd.h>
 #include <iostream>
 #include <list>
+#include <string>
 #include <vector>
 
 using namespace std;
 
 #define MAX_LINE 81
+#define MAX_TOKENS 25
+
+class ProcessLauncher;
 
 class Process {
  public:
@@ -23,20 +28,39 @@ class Process {
 
   void split_string();
   char *cmd;
-  char *cmdTokens[25];
+  char *cmdTokens[MAX_TOKENS];
 
   bool pipe_in;
   bool pipe_out;
 
   int pipe_fd[2];
+
+  // the commands a `while` loop runs for each line (see builtin_while())
+  list<Process *> body;
+
+  // the QosClass of the pipeline (see qos.h)
+  int qos;
+
+  // a function call, whose body holds the function's commands (see alias.h)
+  bool call;
+
+  // the body of the function a `function NAME` command defines
+  string definition;
+
+  Process *clone() const;
 };
 
 void run();
+int run_line(const char *line);
 void display_prompt();
 void cleanup(list<Process *> &process_list, char *input_line);
 char *read_input();
 void parse_input(char *input_line, list<Process *> &process_list);
 bool run_commands(list<Process *> &command_list);
+bool run_commands(list<Process *> &command_list, ProcessLauncher &launcher,
+                  int in_fd = -1, int out_fd = -1, int err_fd = -1,
+                  int *status = nullptr);
+int exit_code(int wait_status);
 bool isQuit(Process *process);
 
 #endif
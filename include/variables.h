@@ -0,0 +1,95 @@
+#ifndef _VARIABLES_H
+#define _VARIABLES_H
+
+#include <tsh.h>
+
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Shell variables.
+ *
+ * Variables are set by `NAME=VALUE` words and by builtins such as read and
+ * mapfile, and live only in the shell: they are not exported to the
+ * environment of commands until `export NAME` moves them there. A variable
+ * that is not set in the shell is looked up in the environment, so $HOME
+ * and $PATH expand as usual.
+ *
+ * An array holds the elements NAME[0], NAME[1], ... Every function may be
+ * called from any thread.
+ */
+void set_variable(const string &name, const string &value);
+
+/**
+ * @brief Replaces the array called name with elements.
+ */
+void set_array(const string &name, const vector<string> &elements);
+
+/**
+ * @brief Looks up a variable, then the environment.
+ * @return false if neither has name.
+ */
+bool get_variable(const string &name, string *value);
+
+/**
+ * @brief Removes name from the shell's variables, its arrays and the
+ * environment.
+ */
+void unset_variable(const string &name);
+
+/**
+ * @brief Moves name into the environment: with value if it is not null,
+ * otherwise with the value of the shell variable name, if there is one.
+ */
+void export_variable(const string &name, const char *value);
+
+/**
+ * @brief export_variable(name, nullptr) for each of names at once.
+ *
+ * setenv() searches and grows the environment one variable at a time, so
+ * exporting n variables takes O(n^2); this builds the new environment in one
+ * pass instead.
+ */
+void export_variables(const vector<string> &names);
+
+/**
+ * @brief Whether word is a `NAME=VALUE` assignment.
+ */
+bool is_assignment(const char *word);
+
+/**
+ * @brief Whether every word of p is an assignment (see is_assignment()),
+ * which makes p a command that only sets variables.
+ */
+bool is_assignment_list(Process *p);
+
+/**
+ * @brief Sets the variable of each `NAME=VALUE` word of p, expanding
+ * VALUE as one word (see expand_word()).
+ */
+void assign_variables(Process *p);
+
+/**
+ * @brief Expands $NAME, ${NAME}, ${NAME[I]} and ${#NAME[@]} in word.
+ *
+ * A '$' not followed by a name or a '{' is kept as it is, so words such as
+ * `foo$` are left alone. Unset variables expand to nothing.
+ *
+ * @return false, without touching out, if word has nothing to expand.
+ */
+bool expand_word(const char *word, string *out);
+
+/**
+ * @brief The `export` builtin: `export NAME[=VALUE]...` exports each name;
+ * with no names it lists the environment as `export NAME=VALUE` lines.
+ */
+int builtin_export(Process *p, int in_fd, int out_fd, int err_fd);
+
+/**
+ * @brief The `unset` builtin: `unset NAME...` (see unset_variable()), or
+ * `unset -f NAME...` to remove functions.
+ */
+int builtin_unset(Process *p, int in_fd, int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,293 @@
+#include <alias.h>
+#include <builtins.h>
+#include <launcher.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+// never destroyed: builtin threads may still be expanding at exit
+static mutex &defs_lock = *new mutex;
+static map<string, string> &aliases = *new map<string, string>;
+static map<string, string> &functions = *new map<string, string>;
+static atomic<uint64_t> version(0);
+
+/**
+ * @brief The Processes a command expands to, copied into each parse.
+ */
+struct Expansion {
+  list<Process *> processes;
+  ~Expansion() { cleanup(processes, nullptr); }
+};
+
+static mutex &cache_lock = *new mutex;
+static unordered_map<string, shared_ptr<Expansion>> &cache =
+    *new unordered_map<string, shared_ptr<Expansion>>;
+// the version of the tables the cached expansions were made under
+static uint64_t cache_version = 0;
+
+void set_alias(const string &name, const string &value) {
+  lock_guard<mutex> guard(defs_lock);
+  aliases[name] = value;
+  version++;
+}
+
+bool remove_alias(const string &name) {
+  lock_guard<mutex> guard(defs_lock);
+  if (!aliases.erase(name)) return false;
+  version++;
+  return true;
+}
+
+bool get_alias(const string &name, string *value) {
+  lock_guard<mutex> guard(defs_lock);
+  auto it = aliases.find(name);
+  if (it == aliases.end()) return false;
+  *value = it->second;
+  return true;
+}
+
+void set_function(const string &name, const string &body) {
+  lock_guard<mutex> guard(defs_lock);
+  functions[name] = body;
+  version++;
+}
+
+bool remove_function(const string &name) {
+  lock_guard<mutex> guard(defs_lock);
+  if (!functions.erase(name)) return false;
+  version++;
+  return true;
+}
+
+bool get_function(const string &name, string *body) {
+  lock_guard<mutex> guard(defs_lock);
+  auto it = functions.find(name);
+  if (it == functions.end()) return false;
+  *body = it->second;
+  return true;
+}
+
+uint64_t definitions_version() { return version; }
+
+static bool is_defined(const char *name) {
+  lock_guard<mutex> guard(defs_lock);
+  return aliases.count(name) || functions.count(name);
+}
+
+static string join_words(char *const *words) {
+  string text;
+  for (int i = 0; words[i]; i++) {
+    if (i) text += ' ';
+    text += words[i];
+  }
+  return text;
+}
+
+/**
+ * @brief body with the positional parameters of the call p put in.
+ */
+static string put_arguments(const string &body, Process *p) {
+  vector<string> args;
+  for (int i = 0; p->cmdTokens[i]; i++) args.push_back(p->cmdTokens[i]);
+  string all = join_words(p->cmdTokens + 1);
+  string out;
+  for (size_t i = 0; i < body.size(); i++) {
+    char c = i + 1 < body.size() ? body[i + 1] : '\0';
+    if (body[i] != '$') {
+      out += body[i];
+    } else if (isdigit((unsigned char)c)) {
+      size_t n = c - '0';
+      if (n < args.size()) out += args[n];
+      i++;
+    } else if (c == '{' && i + 3 < body.size() &&
+               isdigit((unsigned char)body[i + 2]) && body[i + 3] == '}') {
+      size_t n = body[i + 2] - '0';
+      if (n < args.size()) out += args[n];
+      i += 3;
+    } else if (c == '#') {
+      out += to_string(args.size() - 1);
+      i++;
+    } else if (c == '@' || c == '*') {
+      out += all;
+      i++;
+    } else {
+      out += body[i];
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Builds the expansion of p, whose first word is an alias or a
+ * function, and caches it if it was asked for outside any expansion.
+ */
+static shared_ptr<Expansion> expansion_of(Process *p,
+                                          set<string> &expanding) {
+  string key = join_words(p->cmdTokens);
+  // a nested expansion depends on the names around it, so only whole
+  // commands are cached
+  bool top = expanding.empty();
+  uint64_t made_under = version;
+  if (top) {
+    lock_guard<mutex> guard(cache_lock);
+    if (cache_version != made_under) {
+      cache.clear();
+      cache_version = made_under;
+    }
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+  }
+
+  shared_ptr<Expansion> e = make_shared<Expansion>();
+  string name = p->cmdTokens[0], text;
+  expanding.insert(name);
+  if (get_alias(name, &text)) {
+    if (p->cmdTokens[1]) text += ' ' + join_words(p->cmdTokens + 1);
+    parse_input((char *)text.c_str(), e->processes, expanding);
+  } else if (get_function(name, &text)) {
+    Process *call = new Process((char *)key.c_str(), 0, 0);
+    call->split_string();
+    call->call = true;
+    text = put_arguments(text, p);
+    parse_input((char *)text.c_str(), call->body, expanding);
+    e->processes.push_back(call);
+  }
+  expanding.erase(name);
+
+  if (top) {
+    lock_guard<mutex> guard(cache_lock);
+    if (cache_version == made_under) {
+      if (cache.size() >= DEFINITION_CACHE) cache.clear();
+      cache[key] = e;
+    }
+  }
+  return e;
+}
+
+void expand_definitions(list<Process *> &process_list,
+                        set<string> &expanding) {
+  for (auto it = process_list.begin(); it != process_list.end();) {
+    Process *p = *it;
+    const char *name = p->cmdTokens[0];
+    if (!name || p->call || !p->body.empty() || !p->definition.empty() ||
+        expanding.count(name) || !is_defined(name)) {
+      ++it;
+      continue;
+    }
+    shared_ptr<Expansion> e = expansion_of(p, expanding);
+    list<Process *> copies;
+    for (Process *t : e->processes) copies.push_back(t->clone());
+    // an alias of nothing still fills its place in a pipeline
+    if (copies.empty()) copies.push_back(new Process((char *)"", 0, 0));
+    copies.front()->pipe_in = p->pipe_in;
+    copies.back()->pipe_out = p->pipe_out;
+    it = process_list.erase(it);
+    process_list.splice(it, copies);
+    delete p;
+  }
+}
+
+/**
+ * @brief Whether every command of body runs as a builtin.
+ */
+static bool builtin_only(const list<Process *> &body) {
+  for (Process *p : body) {
+    if (!p->call && !find_builtin(p->cmdTokens[0])) return false;
+    if (!builtin_only(p->body)) return false;
+  }
+  return true;
+}
+
+int run_call(Process *p, int in_fd, int out_fd, int err_fd) {
+  // never destroyed: calls may still run on builtin threads at exit
+  static PosixLauncher &launcher = *new PosixLauncher;
+  int status = 0;
+  run_commands(p->body, launcher, in_fd, out_fd, err_fd, &status);
+  return status;
+}
+
+const Builtin *call_builtin(Process *p) {
+  static const Builtin call = {"call", run_call};
+  return builtin_only(p->body) ? &call : nullptr;
+}
+
+/**
+ * @brief Removes one pair of quotes around value, as `alias ll='ls -l'`
+ * leaves them since the parser does not know quotes.
+ */
+static string unquote(string value) {
+  if (value.size() >= 2 && (value[0] == '\'' || value[0] == '"') &&
+      value.back() == value[0]) {
+    value = value.substr(1, value.size() - 2);
+  }
+  return value;
+}
+
+bool alias_definition(Process *p, string *name, string *value) {
+  if (!p->cmdTokens[0] || strcmp(p->cmdTokens[0], "alias") != 0 ||
+      !p->cmdTokens[1]) {
+    return false;
+  }
+  const char *eq = strchr(p->cmdTokens[1], '=');
+  if (!eq || eq == p->cmdTokens[1]) return false;
+  *name = string((const char *)p->cmdTokens[1], eq);
+  *value = eq + 1;
+  if (p->cmdTokens[2]) *value += ' ' + join_words(p->cmdTokens + 2);
+  *value = unquote(*value);
+  return true;
+}
+
+int builtin_alias(Process *p, int, int out_fd, int err_fd) {
+  string name, value, out;
+  if (alias_definition(p, &name, &value)) {
+    set_alias(name, value);
+    return 0;
+  }
+  int status = 0;
+  {
+    lock_guard<mutex> guard(defs_lock);
+    if (!p->cmdTokens[1]) {
+      for (auto &a : aliases) {
+        out += "alias " + a.first + "='" + a.second + "'\n";
+      }
+    }
+    for (int i = 1; p->cmdTokens[i]; i++) {
+      auto it = aliases.find(p->cmdTokens[i]);
+      if (it == aliases.end()) {
+        dprintf(err_fd, "tsh: alias: %s: not found\n", p->cmdTokens[i]);
+        status = 1;
+        continue;
+      }
+      out += "alias " + it->first + "='" + it->second + "'\n";
+    }
+  }
+  if (write_all(out_fd, out.data(), out.size()) == -1) {
+    return write_error_status(errno);
+  }
+  return status;
+}
+
+int builtin_unalias(Process *p, int, int, int err_fd) {
+  int status = 0;
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    if (!remove_alias(p->cmdTokens[i])) {
+      dprintf(err_fd, "tsh: unalias: %s: not found\n", p->cmdTokens[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+int builtin_function(Process *p, int, int, int err_fd) {
+  if (!p->cmdTokens[1] || p->definition.empty()) {
+    dprintf(err_fd, "tsh: function: usage: function NAME { COMMANDS; }\n");
+    return 2;
+  }
+  set_function(p->cmdTokens[1], p->definition);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <alias.h>
+#include <builtins.h>
+#include <complete.h>
+#include <fileutils.h>
+#include <grep.h>
+#include <history.h>
+#include <lineread.h>
+#include <pathcache.h>
+#include <qos.h>
+#include <sort.h>
+#include <textutils.h>
+#include <variables.h>
+#include <signal.h>
+#include <spawn.h>
+
+extern char **environ;
+
+static const Builtin builtins[] = {
+    {"alias", builtin_alias},
+    {"cat", builtin_cat},
+    {"complete", builtin_complete},
+    {"cp", builtin_cp},
+    {"echo", builtin_echo},
+    {"export", builtin_export},
+    {"function", builtin_function},
+    {"grep", builtin_grep},
+    {"head", builtin_head},
+    {"history", builtin_history},
+    {"mapfile", builtin_mapfile},
+    {"qos", builtin_qos},
+    {"read", builtin_read},
+    {"sort", builtin_sort},
+    {"tail", builtin_tail},
+    {"unalias", builtin_unalias},
+    {"unset", builtin_unset},
+    {"wc", builtin_wc},
+    {"while", builtin_while},
+};
+
+const Builtin *find_builtin(const char *name) {
+  if (!name) return nullptr;
+  for (const Builtin &b : builtins) {
+    if (strcmp(b.name, name) == 0) return &b;
+  }
+  return nullptr;
+}
+
+vector<const char *> builtin_names() {
+  vector<const char *> names;
+  for (const Builtin &b : builtins) names.push_back(b.name);
+  return names;
+}
+
+int run_external(Process *p, int in_fd, int out_fd, int err_fd) {
+  string path = path_lookup(p->cmdTokens[0]);
+  if (path.empty()) {
+    dprintf(err_fd, "tsh: %s: command not found\n", p->cmdTokens[0]);
+    return 127;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+  pid_t pid;
+  int err = posix_spawn(&pid, path.c_str(), &actions, NULL, p->cmdTokens,
+                        environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    dprintf(err_fd, "tsh: %s: %s\n", p->cmdTokens[0], strerror(err));
+    return 126;
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  return exit_code(status);
+}
+
+int write_all(int fd, const char *buf, size_t n) {
+  for (size_t done = 0; done < n;) {
+    ssize_t w = write(fd, buf + done, n - done);
+    if (w < 0 && errno == EINTR) continue;
+    if (w < 0) return -1;
+    done += w;
+  }
+  return 0;
+}
+
+int write_error_status(int err) { return err == EPIPE ? 128 + SIGPIPE : 1; }
@@ -0,0 +1,50 @@
+#include <server.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * @brief tsh_client: a small client for `tsh_app --serve`.
+ *
+ * `tsh_client SOCKET command...` sends one command together with the
+ * client's own stdin, stdout and stderr, so the command reads and writes the
+ * terminal directly, and exits with the command's exit code.
+ *
+ * `tsh_client SOCKET` reads command lines from stdin, sends them without
+ * descriptors and prints each command's captured output.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s SOCKET [command...]\n", argv[0]);
+    exit(2);
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror(argv[1]);
+    exit(2);
+  }
+
+  if (argc > 2) {
+    string line = argv[2];
+    for (int i = 3; i < argc; i++) line += string(" ") + argv[i];
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    if (send_request(sock, line.c_str(), fds) == -1) exit(2);
+    int status = read_reply(sock, NULL);
+    exit(status < 0 ? 2 : status);
+  }
+
+  int status = 0;
+  char *line;
+  while ((line = read_input()) != NULL) {
+    string out;
+    if (send_request(sock, line, NULL) == -1) exit(2);
+    free(line);
+    status = read_reply(sock, &out);
+    if (status < 0) exit(2);
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+  }
+  exit(status);
+}
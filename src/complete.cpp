@@ -0,0 +1,289 @@
+#include <builtins.h>
+#include <complete.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pathcache.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+static long now_ms() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Reads every entry of dir with getdents64 into a large buffer.
+ *
+ * @param fn Called with each name (except . and ..) and its d_type.
+ * @return false if the directory could not be opened.
+ */
+template <typename F>
+static bool read_dir(const string &dir, F fn) {
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return false;
+  vector<char> buf(COMPLETE_DENTS_BUF);
+  ssize_t n;
+  while ((n = getdents64(fd, buf.data(), buf.size())) > 0) {
+    for (ssize_t off = 0; off < n;) {
+      struct dirent64 *d = (struct dirent64 *)(buf.data() + off);
+      off += d->d_reclen;
+      if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+        continue;
+      }
+      fn(d->d_name, d->d_type);
+    }
+  }
+  close(fd);
+  return true;
+}
+
+static vector<string> split_path(const string &path_env) {
+  vector<string> dirs;
+  size_t start = 0;
+  while (start <= path_env.size()) {
+    size_t end = path_env.find(':', start);
+    if (end == string::npos) end = path_env.size();
+    dirs.push_back(end > start ? path_env.substr(start, end - start) : ".");
+    start = end + 1;
+  }
+  return dirs;
+}
+
+static string current_path_env() {
+  const char *env = getenv("PATH");
+  return env ? env : "/usr/local/bin:/usr/bin:/bin";
+}
+
+Completer::Completer()
+    : building(false), built(false), inotify_fd(-1), stopping(false) {}
+
+Completer::~Completer() {
+  stopping = true;
+  if (builder.joinable()) builder.join();
+  if (watcher.joinable()) watcher.join();
+  if (inotify_fd != -1) close(inotify_fd);
+}
+
+/**
+ * @brief Adds (delta = 1) or removes (delta = -1) one occurrence of name.
+ *
+ * Names are never unlinked from the trie; a count of zero just hides them.
+ * Must be called with lock held.
+ */
+void Completer::insert(const char *name, int delta) {
+  if (trie.empty()) trie.push_back({{}, 0});
+  uint32_t node = 0;
+  for (const char *c = name; *c; c++) {
+    vector<pair<char, uint32_t>> &next = trie[node].next;
+    auto it = lower_bound(next.begin(), next.end(), make_pair(*c, (uint32_t)0));
+    if (it != next.end() && it->first == *c) {
+      node = it->second;
+      continue;
+    }
+    if (delta < 0) return;
+    uint32_t child = trie.size();
+    next.insert(it, {*c, child});
+    // next may be invalidated by the push_back below; it is not used again
+    trie.push_back({{}, 0});
+    node = child;
+  }
+  if (delta < 0 && trie[node].count == 0) return;
+  trie[node].count += delta;
+}
+
+/**
+ * @brief Builds the trie for path_env and starts watching its directories.
+ */
+void Completer::build_trie(const string &path_env) {
+  vector<string> path_dirs = split_path(path_env);
+  vector<string> names;
+  for (const string &dir : path_dirs) {
+    if (stopping) return;
+    read_dir(dir, [&](const char *name, unsigned char type) {
+      if (type == DT_REG || type == DT_LNK || type == DT_UNKNOWN) {
+        names.push_back(name);
+      }
+    });
+  }
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  map<int, string> wds;
+  if (fd != -1) {
+    for (const string &dir : path_dirs) {
+      int wd = inotify_add_watch(fd, dir.c_str(),
+                                 IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                     IN_MOVED_TO | IN_ONLYDIR);
+      if (wd != -1) wds[wd] = dir;
+    }
+  }
+
+  lock_guard<mutex> guard(lock);
+  trie.clear();
+  for (const string &name : names) insert(name.c_str(), 1);
+  for (const char *name : builtin_names()) insert(name, 1);
+  if (inotify_fd != -1) close(inotify_fd);
+  inotify_fd = fd;
+  watches.swap(wds);
+  trie_path = path_env;
+  building = false;
+  built = true;
+  built_cond.notify_all();
+}
+
+/**
+ * @brief Applies inotify events to the trie until the completer is
+ * destroyed.
+ */
+void Completer::watch() {
+  char buf[64 * 1024]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (!stopping) {
+    int fd;
+    {
+      lock_guard<mutex> guard(lock);
+      fd = inotify_fd;
+    }
+    if (fd == -1) {
+      this_thread::sleep_for(chrono::milliseconds(200));
+      continue;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) continue;
+
+    lock_guard<mutex> guard(lock);
+    // the trie may have been rebuilt with a new descriptor meanwhile
+    if (fd != inotify_fd) continue;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    for (ssize_t off = 0; off < n;) {
+      struct inotify_event *ev = (struct inotify_event *)(buf + off);
+      off += sizeof(struct inotify_event) + ev->len;
+      if (!ev->len || (ev->mask & IN_ISDIR)) continue;
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO)) insert(ev->name, 1);
+      if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) insert(ev->name, -1);
+    }
+    // resolved paths may now be stale too
+    if (n > 0) path_cache_clear();
+  }
+}
+
+/**
+ * @brief Starts building the trie if it does not exist yet or $PATH changed.
+ */
+void Completer::ensure_trie() {
+  string path_env = current_path_env();
+  lock_guard<mutex> guard(lock);
+  if (building || (built && trie_path == path_env)) return;
+  building = true;
+  built = false;
+  if (builder.joinable()) builder.join();
+  builder = thread(&Completer::build_trie, this, path_env);
+  if (!watcher.joinable()) watcher = thread(&Completer::watch, this);
+}
+
+void Completer::collect(uint32_t node, string &prefix, vector<string> &out) {
+  if (trie[node].count > 0) out.push_back(prefix);
+  for (const pair<char, uint32_t> &edge : trie[node].next) {
+    prefix += edge.first;
+    collect(edge.second, prefix, out);
+    prefix.pop_back();
+  }
+}
+
+vector<string> Completer::complete_command(const string &prefix) {
+  ensure_trie();
+  unique_lock<mutex> guard(lock);
+  built_cond.wait(guard, [this]() { return built || stopping; });
+
+  vector<string> out;
+  if (trie.empty()) return out;
+  uint32_t node = 0;
+  for (char c : prefix) {
+    const vector<pair<char, uint32_t>> &next = trie[node].next;
+    auto it = lower_bound(next.begin(), next.end(), make_pair(c, (uint32_t)0));
+    if (it == next.end() || it->first != c) return out;
+    node = it->second;
+  }
+  string word = prefix;
+  collect(node, word, out);
+  return out;
+}
+
+/**
+ * @brief Returns the listing of dir, reading it again once it is older than
+ * COMPLETE_DIR_TTL_MS.
+ */
+Completer::Listing Completer::list_dir(const string &dir) {
+  {
+    lock_guard<mutex> guard(dir_lock);
+    auto it = dirs.find(dir);
+    if (it != dirs.end() &&
+        now_ms() - it->second.loaded_ms < COMPLETE_DIR_TTL_MS) {
+      return it->second;
+    }
+  }
+  // read without holding the lock so one slow directory blocks nobody else
+  Listing listing = {now_ms(), {}};
+  read_dir(dir, [&](const char *name, unsigned char type) {
+    listing.entries.push_back({name, type == DT_DIR});
+  });
+  lock_guard<mutex> guard(dir_lock);
+  dirs[dir] = listing;
+  return listing;
+}
+
+vector<string> Completer::complete_path(const string &prefix) {
+  size_t slash = prefix.rfind('/');
+  string dir = slash == string::npos ? "." : prefix.substr(0, slash + 1);
+  string base = slash == string::npos ? prefix : prefix.substr(slash + 1);
+  string shown = slash == string::npos ? "" : dir;
+
+  vector<string> out;
+  Listing listing = list_dir(dir);
+  for (const pair<string, bool> &entry : listing.entries) {
+    // hidden files only when asked for
+    if (entry.first[0] == '.' && (base.empty() || base[0] != '.')) continue;
+    if (entry.first.compare(0, base.size(), base) != 0) continue;
+    out.push_back(shown + entry.first + (entry.second ? "/" : ""));
+  }
+  sort(out.begin(), out.end());
+  return out;
+}
+
+future<vector<string>> Completer::complete(const string &line) {
+  // find the word under completion and whether it starts a pipeline stage
+  size_t start = line.find_last_of(" \t|;");
+  string word = start == string::npos ? line : line.substr(start + 1);
+  size_t before = start == string::npos ? string::npos
+                                        : line.find_last_not_of(" \t", start);
+  bool command = before == string::npos || line[before] == '|' ||
+                 line[before] == ';';
+  if (command && word.find('/') == string::npos) {
+    return async(launch::async, [this, word]() {
+      return complete_command(word);
+    });
+  }
+  return async(launch::async, [this, word]() { return complete_path(word); });
+}
+
+Completer *shell_completer() {
+  static Completer *completer = new Completer();
+  return completer;
+}
+
+int builtin_complete(Process *p, int, int out_fd, int) {
+  string line;
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    if (i > 1) line += ' ';
+    line += p->cmdTokens[i];
+  }
+  for (const string &candidate : shell_completer()->complete(line).get()) {
+    dprintf(out_fd, "%s\n", candidate.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,725 @@
+#include <complete.h>
+#include <editor.h>
+#include <history.h>
+#include <poll.h>
+#include <prompt.h>
+#include <signal.h>
+#include <speculate.h>
+#include <sys/ioctl.h>
+
+#include <chrono>
+
+using namespace std;
+
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+#define PASTE_ON "\033[?2004h"
+#define PASTE_OFF "\033[?2004l"
+
+static volatile sig_atomic_t resized = 0;
+
+static void on_winch(int) { resized = 1; }
+
+static inline bool is_lead(char c) { return ((unsigned char)c & 0xc0) != 0x80; }
+
+static inline bool is_word(char c) {
+  return isalnum((unsigned char)c) || c == '_' || ((unsigned char)c & 0x80);
+}
+
+/**
+ * @brief Columns taken by n bytes of UTF-8 text, one per character.
+ */
+static size_t text_width(const char *s, size_t n) {
+  size_t width = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (is_lead(s[i])) width++;
+  }
+  return width;
+}
+
+static long now_ms() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static string move_to(size_t col) { return "\033[" + to_string(col + 1) + "G"; }
+
+LineEditor::LineEditor(int _in_fd, int _out_fd)
+    : in_fd(_in_fd),
+      out_fd(_out_fd),
+      active(false),
+      pos(0),
+      in_paste(false),
+      eof(false),
+      last_kill(false),
+      history(nullptr),
+      hist_index(0),
+      searching(false),
+      search_failed(false),
+      search_skip(0),
+      completer(nullptr),
+      completing(false),
+      completion_pos(0),
+      completion_ms(0),
+      shown_col(0),
+      view_start(0),
+      cols(EDITOR_DEFAULT_COLS),
+      redraw_full(false) {
+  is_tty = isatty(in_fd) && tcgetattr(in_fd, &saved) == 0;
+  if (is_tty) {
+    struct sigaction sa = {};
+    sa.sa_handler = on_winch;
+    // poll() is interrupted regardless, everything else restarts
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+  }
+}
+
+LineEditor::~LineEditor() {
+  if (active) raw_mode(false);
+}
+
+void LineEditor::set_history(History *_history) { history = _history; }
+
+void LineEditor::set_completer(Completer *_completer) {
+  completer = _completer;
+}
+
+/**
+ * @brief Switches the terminal to raw input, keeping output processing so
+ * that whatever else writes to it is unaffected.
+ */
+void LineEditor::raw_mode(bool on) {
+  if (!is_tty) return;
+  if (!on) {
+    tcsetattr(in_fd, TCSADRAIN, &saved);
+    return;
+  }
+  // taken every time, since a command may have changed the settings
+  if (tcgetattr(in_fd, &saved) == -1) return;
+  struct termios raw = saved;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cflag |= CS8;
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(in_fd, TCSADRAIN, &raw);
+}
+
+static size_t terminal_cols(int fd) {
+  struct winsize ws;
+  if (ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+  const char *env = getenv("COLUMNS");
+  size_t cols = env ? strtoul(env, NULL, 10) : 0;
+  return cols > 0 ? cols : EDITOR_DEFAULT_COLS;
+}
+
+void LineEditor::write_all(const string &out) {
+  size_t done = 0;
+  while (done < out.size()) {
+    ssize_t n = write(out_fd, out.data() + done, out.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    done += n;
+  }
+}
+
+/**
+ * @brief Brings the screen up to date with a single write.
+ *
+ * Only the cells from the first difference on are rewritten. The line is
+ * shown through a window that jumps by half its width when the cursor leaves
+ * it, so typing at the end of a long line rewrites the row only now and then.
+ *
+ * @param full Redraw the whole row, e.g. after the screen was cleared.
+ * @param tail Appended to the same write.
+ */
+void LineEditor::render(bool full, const string &tail) {
+  full = full || redraw_full;
+  redraw_full = false;
+  string label = prompt;
+  const string *text = &buf;
+  size_t cursor = pos;
+  if (searching) {
+    label = string(search_failed ? "(failed reverse-i-search)`"
+                                 : "(reverse-i-search)`") +
+            query + "': ";
+    text = &match;
+    cursor = query.empty() ? string::npos : match.find(query);
+    if (cursor == string::npos) cursor = 0;
+  }
+  size_t label_width = prompt_width(label);
+  size_t avail = cols > label_width + 1 ? cols - label_width - 1 : 1;
+
+  if (text_width(text->data(), text->size()) <= avail) {
+    view_start = 0;
+  } else if (view_start > cursor ||
+             text_width(text->data() + view_start, cursor - view_start) >
+                 avail) {
+    // put the cursor in the middle of the window
+    view_start = cursor;
+    for (size_t w = 0; view_start > 0 && w < avail / 2;) {
+      view_start--;
+      if (is_lead((*text)[view_start])) w++;
+    }
+  }
+  size_t end = view_start, width = 0;
+  for (; end < text->size(); end++) {
+    if (is_lead((*text)[end])) {
+      if (width == avail) break;
+      width++;
+    }
+  }
+  string visible = text->substr(view_start, end - view_start);
+
+  string out;
+  out.swap(pending_out);
+  size_t col = shown_col;
+  if (full || label != shown_label) {
+    out += '\r';
+    out += label;
+    out += visible;
+    out += "\033[K";
+    col = label_width + width;
+  } else {
+    size_t same = 0;
+    while (same < visible.size() && same < shown_text.size() &&
+           visible[same] == shown_text[same]) {
+      same++;
+    }
+    while (same > 0 && same < visible.size() && !is_lead(visible[same])) {
+      same--;
+    }
+    if (same < visible.size() || same < shown_text.size()) {
+      size_t from = label_width + text_width(visible.data(), same);
+      if (from != col) out += move_to(from);
+      out.append(visible, same, string::npos);
+      if (text_width(shown_text.data(), shown_text.size()) > width) {
+        out += "\033[K";
+      }
+      col = label_width + width;
+    }
+  }
+  size_t target =
+      label_width + text_width(text->data() + view_start, cursor - view_start);
+  if (target != col) out += move_to(target);
+  out += tail;
+  shown_label = label;
+  shown_text = visible;
+  shown_col = target;
+  if (!out.empty()) write_all(out);
+}
+
+size_t LineEditor::char_left(size_t from) {
+  while (from > 0 && !is_lead(buf[--from])) {
+  }
+  return from;
+}
+
+size_t LineEditor::char_right(size_t from) {
+  if (from < buf.size()) from++;
+  while (from < buf.size() && !is_lead(buf[from])) from++;
+  return from;
+}
+
+size_t LineEditor::word_left(size_t from) {
+  while (from > 0 && !is_word(buf[from - 1])) from--;
+  while (from > 0 && is_word(buf[from - 1])) from--;
+  return from;
+}
+
+size_t LineEditor::word_right(size_t from) {
+  while (from < buf.size() && !is_word(buf[from])) from++;
+  while (from < buf.size() && is_word(buf[from])) from++;
+  return from;
+}
+
+void LineEditor::insert(const string &text) {
+  if (searching) {
+    query += text;
+    search(0);
+    return;
+  }
+  buf.insert(pos, text);
+  pos += text.size();
+}
+
+/**
+ * @brief Cuts [from, to) into the kill buffer. Right after another kill the
+ * text is added to the buffer instead, in front of it when killing backwards.
+ */
+void LineEditor::kill(size_t from, size_t to) {
+  string text = buf.substr(from, to - from);
+  if (!last_kill) {
+    kill_buf = text;
+  } else if (to == pos) {
+    kill_buf = text + kill_buf;
+  } else {
+    kill_buf += text;
+  }
+  buf.erase(from, to - from);
+  pos = from;
+}
+
+/**
+ * @brief Steps to an older (direction 1) or newer (-1) history entry. The
+ * line being typed is kept and comes back below the newest entry.
+ */
+void LineEditor::history_move(int direction) {
+  if (!history) return;
+  if (direction > 0) {
+    string entry;
+    if (!history->recent(hist_index, &entry)) return;
+    if (hist_index == 0) saved_line = buf;
+    hist_index++;
+    buf = entry;
+  } else {
+    if (hist_index == 0) return;
+    hist_index--;
+    if (hist_index == 0) {
+      buf = saved_line;
+    } else {
+      history->recent(hist_index - 1, &buf);
+    }
+  }
+  pos = buf.size();
+}
+
+/**
+ * @brief Shows the skip-th newest history entry containing the query, or
+ * keeps the current match and flags the search as failed.
+ */
+void LineEditor::search(size_t skip) {
+  if (query.empty()) {
+    match.clear();
+    search_failed = false;
+    search_skip = 0;
+    return;
+  }
+  vector<string> found;
+  if (history) found = history->search(query.c_str(), skip + 1);
+  if (found.size() > skip) {
+    match = found[skip];
+    search_skip = skip;
+    search_failed = false;
+  } else {
+    search_failed = true;
+  }
+}
+
+/**
+ * @brief Starts completing the word before the cursor. The result is picked
+ * up by finish_completion() once the completer is done.
+ */
+void LineEditor::complete() {
+  if (!completer) {
+    pending_out += '\a';
+    return;
+  }
+  if (completing) return;
+  completion = completer->complete(buf.substr(0, pos));
+  completion_line = buf;
+  completion_pos = pos;
+  completion_ms = now_ms();
+  completing = true;
+}
+
+/**
+ * @brief Whether input is held back for a completion that may still land.
+ */
+bool LineEditor::holding() {
+  return completing && now_ms() - completion_ms < EDITOR_COMPLETE_WAIT_MS;
+}
+
+/**
+ * @brief Applies a finished completion, unless the line changed meanwhile.
+ *
+ * A single candidate replaces the word; several extend it to their common
+ * prefix, or are listed below the line when there is nothing to extend.
+ */
+void LineEditor::finish_completion() {
+  completing = false;
+  vector<string> found = completion.get();
+  if (buf != completion_line || pos != completion_pos || searching) return;
+  size_t start = pos;
+  while (start > 0 && !strchr(" \t|;", buf[start - 1])) start--;
+  if (found.empty()) {
+    pending_out += '\a';
+    return;
+  }
+  string common = found[0];
+  for (const string &candidate : found) {
+    size_t n = 0;
+    while (n < common.size() && n < candidate.size() &&
+           common[n] == candidate[n]) {
+      n++;
+    }
+    common.resize(n);
+  }
+  if (found.size() == 1 && common.back() != '/') common += ' ';
+  if (common.size() > pos - start) {
+    buf.replace(start, pos - start, common);
+    pos = start + common.size();
+    return;
+  }
+  if (found.size() == 1) return;
+  string list = "\r\n";
+  for (size_t i = 0; i < found.size() && i < EDITOR_MAX_LISTED; i++) {
+    list += found[i];
+    list += "  ";
+  }
+  if (found.size() > EDITOR_MAX_LISTED) {
+    list += "(" + to_string(found.size() - EDITOR_MAX_LISTED) + " more)";
+  }
+  list += "\r\n";
+  pending_out += list;
+  redraw_full = true;
+}
+
+/**
+ * @brief Applies one key: a control character, an escape sequence or a run
+ * of printable text.
+ * @return true when the line is done (Enter, or ^D on an empty line).
+ */
+bool LineEditor::key(const string &seq) {
+  char c = seq[0];
+  bool control = seq.size() == 1 && ((unsigned char)c < 0x20 || c == 0x7f);
+
+  if (searching) {
+    if (!control && c != '\033') {
+      insert(seq);
+      return false;
+    }
+    if (c == 0x7f || c == '\b') {
+      if (!query.empty()) query.pop_back();
+      while (!query.empty() && !is_lead(query.back())) query.pop_back();
+      search(0);
+      return false;
+    }
+    if (c == 0x12) {
+      search(search_skip + 1);
+      return false;
+    }
+    searching = false;
+    if (seq == "\033" || c == 0x07) {
+      buf = before_search;
+      pos = buf.size();
+      return false;
+    }
+    // any other key takes the match and then does its usual job
+    buf = match;
+    pos = query.empty() ? string::npos : match.find(query);
+    if (pos == string::npos) pos = 0;
+  }
+
+  bool killed = false;
+  if (control) {
+    switch (c) {
+      case 0x01:
+        pos = 0;
+        break;
+      case 0x02:
+        pos = char_left(pos);
+        break;
+      case 0x03:
+        pending_out += "^C\r\n";
+        redraw_full = true;
+        buf.clear();
+        pos = 0;
+        hist_index = 0;
+        break;
+      case 0x04:
+        if (buf.empty()) {
+          eof = true;
+          return true;
+        }
+        buf.erase(pos, char_right(pos) - pos);
+        break;
+      case 0x05:
+        pos = buf.size();
+        break;
+      case 0x06:
+        pos = char_right(pos);
+        break;
+      case '\b':
+      case 0x7f: {
+        size_t from = char_left(pos);
+        buf.erase(from, pos - from);
+        pos = from;
+        break;
+      }
+      case '\t':
+        complete();
+        break;
+      case '\n':
+      case '\r':
+        return true;
+      case 0x0b:
+        kill(pos, buf.size());
+        killed = true;
+        break;
+      case 0x0c:
+        pending_out += "\033[H\033[2J";
+        redraw_full = true;
+        break;
+      case 0x0e:
+        history_move(-1);
+        break;
+      case 0x10:
+        history_move(1);
+        break;
+      case 0x12:
+        searching = true;
+        search_failed = false;
+        before_search = buf;
+        query.clear();
+        match.clear();
+        search_skip = 0;
+        break;
+      case 0x15:
+        kill(0, pos);
+        killed = true;
+        break;
+      case 0x17:
+        kill(word_left(pos), pos);
+        killed = true;
+        break;
+      case 0x19:
+        insert(kill_buf);
+        break;
+    }
+  } else if (c == '\033') {
+    if (seq == "\033[A" || seq == "\033OA") {
+      history_move(1);
+    } else if (seq == "\033[B" || seq == "\033OB") {
+      history_move(-1);
+    } else if (seq == "\033[C" || seq == "\033OC") {
+      pos = char_right(pos);
+    } else if (seq == "\033[D" || seq == "\033OD") {
+      pos = char_left(pos);
+    } else if (seq == "\033[H" || seq == "\033OH" || seq == "\033[1~" ||
+               seq == "\033[7~") {
+      pos = 0;
+    } else if (seq == "\033[F" || seq == "\033OF" || seq == "\033[4~" ||
+               seq == "\033[8~") {
+      pos = buf.size();
+    } else if (seq == "\033[3~") {
+      buf.erase(pos, char_right(pos) - pos);
+    } else if (seq == "\033f" || seq == "\033[1;5C" || seq == "\033[1;3C") {
+      pos = word_right(pos);
+    } else if (seq == "\033b" || seq == "\033[1;5D" || seq == "\033[1;3D") {
+      pos = word_left(pos);
+    } else if (seq == "\033d") {
+      kill(pos, word_right(pos));
+      killed = true;
+    } else if (seq == "\033\177") {
+      kill(word_left(pos), pos);
+      killed = true;
+    }
+  } else {
+    insert(seq);
+  }
+  last_kill = killed;
+  return false;
+}
+
+/**
+ * @brief Applies the buffered input, leaving incomplete escape sequences and
+ * everything after the end of the line for later.
+ * @return true when the line is done.
+ */
+bool LineEditor::feed() {
+  size_t i = 0;
+  bool done = false;
+  while (i < input.size() && !done && !holding()) {
+    if (in_paste) {
+      size_t end = input.find(PASTE_END, i);
+      size_t stop = end == string::npos ? input.size() : end;
+      if (end == string::npos) {
+        // the terminator may be split across reads
+        for (size_t k = min<size_t>(strlen(PASTE_END) - 1, stop - i); k > 0;
+             k--) {
+          if (input.compare(stop - k, k, PASTE_END, k) == 0) {
+            stop -= k;
+            break;
+          }
+        }
+      }
+      string text = input.substr(i, stop - i);
+      for (char &ch : text) {
+        if (ch == '\n' || ch == '\r') {
+          ch = ';';
+        } else if ((unsigned char)ch < 0x20 || ch == 0x7f) {
+          ch = ' ';
+        }
+      }
+      insert(text);
+      i = stop;
+      if (end == string::npos) break;
+      i += strlen(PASTE_END);
+      in_paste = false;
+      continue;
+    }
+
+    unsigned char c = input[i];
+    if (c == '\033') {
+      if (i + 1 >= input.size()) break;
+      size_t len = 2;
+      if (input[i + 1] == '[' || input[i + 1] == 'O') {
+        size_t j = i + 2;
+        while (j < input.size() &&
+               ((unsigned char)input[j] < 0x40 || (unsigned char)input[j] > 0x7e)) {
+          j++;
+        }
+        if (j >= input.size()) break;
+        len = j + 1 - i;
+      }
+      string seq = input.substr(i, len);
+      i += len;
+      if (seq == PASTE_START) {
+        in_paste = true;
+        continue;
+      }
+      done = key(seq);
+    } else if (c >= 0x20 && c != 0x7f) {
+      // printable text goes in as one run, however long
+      size_t j = i;
+      while (j < input.size() && (unsigned char)input[j] >= 0x20 &&
+             input[j] != 0x7f) {
+        j++;
+      }
+      done = key(input.substr(i, j - i));
+      i = j;
+    } else {
+      done = key(string(1, c));
+      i++;
+    }
+  }
+  input.erase(0, i);
+  return done;
+}
+
+bool LineEditor::read_line(const string &_prompt, string *line) {
+  unique_lock<mutex> guard(lock);
+  prompt = _prompt;
+  buf.clear();
+  pos = 0;
+  eof = false;
+  last_kill = false;
+  hist_index = 0;
+  searching = false;
+  completing = false;
+  speculated.clear();
+  shown_label.clear();
+  shown_text.clear();
+  shown_col = 0;
+  view_start = 0;
+  cols = terminal_cols(out_fd);
+  active = true;
+  raw_mode(true);
+  if (is_tty) pending_out += PASTE_ON;
+  render(true);
+
+  // typeahead left over from the previous line comes first
+  bool done = feed();
+  bool more = false;
+  char chunk[EDITOR_READ_BUF];
+  while (!done) {
+    if (!more) render(false);
+    int timeout = -1;
+    if (completing) {
+      timeout = EDITOR_POLL_MS;
+    } else if (input == "\033") {
+      timeout = EDITOR_ESC_MS;
+    } else if (buf != speculated) {
+      timeout = EDITOR_IDLE_MS;
+    }
+    struct pollfd pfd = {in_fd, POLLIN, 0};
+    guard.unlock();
+    int ready = poll(&pfd, 1, timeout);
+    guard.lock();
+    more = false;
+    if (resized) {
+      resized = 0;
+      cols = terminal_cols(out_fd);
+      redraw_full = true;
+    }
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      eof = buf.empty();
+      break;
+    }
+    if (ready == 0) {
+      if (completing &&
+          completion.wait_for(chrono::seconds(0)) == future_status::ready) {
+        finish_completion();
+        done = feed();
+      } else if (completing && !holding()) {
+        done = feed();
+      } else if (input == "\033") {
+        input.clear();
+        done = key("\033");
+      } else if (!completing && buf != speculated) {
+        speculated = buf;
+        if (!buf.empty()) speculate(buf.c_str());
+      }
+      continue;
+    }
+    ssize_t n = read(in_fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      // end of input: a partial last line still counts
+      if (searching) {
+        buf = match;
+        searching = false;
+      }
+      eof = buf.empty();
+      break;
+    }
+    input.append(chunk, n);
+    done = feed();
+    // draw once for everything that is already waiting
+    pfd.revents = 0;
+    more = !done && poll(&pfd, 1, 0) > 0;
+  }
+
+  if (searching) {
+    buf = match;
+    searching = false;
+  }
+  render(false, string("\r\n") + (is_tty ? PASTE_OFF : ""));
+  raw_mode(false);
+  active = false;
+  if (eof) return false;
+  *line = buf;
+  return true;
+}
+
+void LineEditor::set_prompt(const string &_prompt) {
+  lock_guard<mutex> guard(lock);
+  prompt = _prompt;
+  if (active) render(false);
+}
+
+static void redraw_prompt(const string &prompt) {
+  shell_editor()->set_prompt(prompt);
+}
+
+LineEditor *shell_editor() {
+  static LineEditor *editor = nullptr;
+  static bool initialized = false;
+  if (!initialized) {
+    initialized = true;
+    const char *term = getenv("TERM");
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+        (term && strcmp(term, "dumb") == 0)) {
+      return nullptr;
+    }
+    editor = new LineEditor(STDIN_FILENO, STDOUT_FILENO);
+    editor->set_history(shell_history());
+    editor->set_completer(shell_completer());
+    prompt_set_redraw(redraw_prompt);
+  }
+  return editor;
+}
@@ -0,0 +1,175 @@
+#include <builtins.h>
+#include <fcntl.h>
+#include <fileutils.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include <memory>
+
+using namespace std;
+
+/**
+ * @brief Whether a failed zero-copy call just means "not for these files",
+ * so the copy should go on with read and write.
+ */
+static inline bool unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV ||
+         err == EOPNOTSUPP || err == EBADF || err == ETXTBSY;
+}
+
+/**
+ * @brief Copies through a user-space buffer. One aligned buffer per thread
+ * is kept for the life of the thread.
+ */
+static int copy_buffered(int in_fd, int out_fd) {
+  static thread_local unique_ptr<char, void (*)(void *)> buf(nullptr, free);
+  if (!buf) {
+    void *mem;
+    if (posix_memalign(&mem, sysconf(_SC_PAGESIZE), COPY_BUF_SIZE) != 0) {
+      errno = ENOMEM;
+      return -1;
+    }
+    buf.reset((char *)mem);
+  }
+  while (true) {
+    ssize_t n = read(in_fd, buf.get(), COPY_BUF_SIZE);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) return 0;
+    if (write_all(out_fd, buf.get(), n) == -1) return -1;
+  }
+}
+
+int copy_fd(int in_fd, int out_fd) {
+  struct stat in_st, out_st;
+  if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) return -1;
+  bool in_file = S_ISREG(in_st.st_mode), out_file = S_ISREG(out_st.st_mode);
+  bool in_pipe = S_ISFIFO(in_st.st_mode), out_pipe = S_ISFIFO(out_st.st_mode);
+
+  while (in_file || in_pipe || out_pipe) {
+    ssize_t n;
+    if (in_file && out_file) {
+      n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+    } else if (in_pipe || out_pipe) {
+      n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+    } else {
+      n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+    }
+    if (n > 0) continue;
+    if (n == 0) return 0;
+    if (errno == EINTR) continue;
+    if (!unsupported(errno)) return -1;
+    // the offsets were advanced by what was copied, so carry on from there
+    break;
+  }
+  return copy_buffered(in_fd, out_fd);
+}
+
+/**
+ * @brief Whether any argument is an option, which the builtin leaves to the
+ * real program.
+ */
+static bool has_options(Process *p) {
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    if (p->cmdTokens[i][0] == '-' && p->cmdTokens[i][1]) return true;
+  }
+  return false;
+}
+
+int builtin_cat(Process *p, int in_fd, int out_fd, int err_fd) {
+  if (has_options(p)) return run_external(p, in_fd, out_fd, err_fd);
+  int status = 0;
+  const char *stdin_only[] = {"-", NULL};
+  char **files = p->cmdTokens[1] ? p->cmdTokens + 1 : (char **)stdin_only;
+  for (int i = 0; files[i]; i++) {
+    int fd = in_fd;
+    if (strcmp(files[i], "-") != 0) {
+      fd = open(files[i], O_RDONLY | O_CLOEXEC);
+      if (fd == -1) {
+        dprintf(err_fd, "tsh: cat: %s: %s\n", files[i], strerror(errno));
+        status = 1;
+        continue;
+      }
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    int result = copy_fd(fd, out_fd);
+    int err = errno;
+    if (fd != in_fd) close(fd);
+    if (result == 0) continue;
+    if (err == EPIPE) return write_error_status(err);
+    dprintf(err_fd, "tsh: cat: %s: %s\n", files[i], strerror(err));
+    status = 1;
+  }
+  return status;
+}
+
+/**
+ * @brief Copies the file src to dst, creating or truncating dst.
+ * @return 0 on success, 1 after reporting an error.
+ */
+static int copy_file(const char *src, const string &dst, int err_fd) {
+  int in = open(src, O_RDONLY | O_CLOEXEC);
+  struct stat in_st, out_st;
+  if (in == -1 || fstat(in, &in_st) == -1) {
+    dprintf(err_fd, "tsh: cp: %s: %s\n", src, strerror(errno));
+    if (in != -1) close(in);
+    return 1;
+  }
+  if (S_ISDIR(in_st.st_mode)) {
+    dprintf(err_fd, "tsh: cp: %s: Is a directory\n", src);
+    close(in);
+    return 1;
+  }
+  if (stat(dst.c_str(), &out_st) == 0 && out_st.st_dev == in_st.st_dev &&
+      out_st.st_ino == in_st.st_ino) {
+    dprintf(err_fd, "tsh: cp: %s and %s are the same file\n", src,
+            dst.c_str());
+    close(in);
+    return 1;
+  }
+  int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 in_st.st_mode & 0777);
+  if (out == -1) {
+    dprintf(err_fd, "tsh: cp: %s: %s\n", dst.c_str(), strerror(errno));
+    close(in);
+    return 1;
+  }
+  int result = copy_fd(in, out);
+  int err = errno;
+  close(in);
+  if (close(out) == -1 && result == 0) {
+    result = -1;
+    err = errno;
+  }
+  if (result == 0) return 0;
+  dprintf(err_fd, "tsh: cp: %s: %s\n", dst.c_str(), strerror(err));
+  return 1;
+}
+
+int builtin_cp(Process *p, int in_fd, int out_fd, int err_fd) {
+  if (has_options(p)) return run_external(p, in_fd, out_fd, err_fd);
+  int argc = 0;
+  while (p->cmdTokens[argc]) argc++;
+  if (argc < 3) {
+    dprintf(err_fd, "tsh: cp: usage: cp SOURCE DEST\n");
+    return 1;
+  }
+  const char *dest = p->cmdTokens[argc - 1];
+  struct stat st;
+  bool to_dir = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+  if (argc > 3 && !to_dir) {
+    dprintf(err_fd, "tsh: cp: %s: Not a directory\n", dest);
+    return 1;
+  }
+  int status = 0;
+  for (int i = 1; i < argc - 1; i++) {
+    string target = dest;
+    if (to_dir) {
+      const char *slash = strrchr(p->cmdTokens[i], '/');
+      target += "/";
+      target += slash ? slash + 1 : p->cmdTokens[i];
+    }
+    status |= copy_file(p->cmdTokens[i], target, err_fd);
+  }
+  return status;
+}
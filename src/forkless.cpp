@@ -0,0 +1,26 @@
+#include <forkless.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+static size_t page_round(size_t size) {
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  return (size + page - 1) & ~(page - 1);
+}
+
+void *forkless_alloc(size_t size) {
+  size = page_round(size);
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  madvise(p, size, MADV_DONTFORK);
+  return p;
+}
+
+void forkless_free(void *p, size_t size) {
+  if (p) munmap(p, page_round(size));
+}
+
+void trim_heap() { malloc_trim(0); }
@@ -0,0 +1,420 @@
+#include <builtins.h>
+#include <fcntl.h>
+#include <grep.h>
+#include <textutils.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static size_t pair_scalar(const char *buf, size_t n, size_t from, char first,
+                          char last, size_t len) {
+  for (size_t i = from; i + len <= n; i++) {
+    if (buf[i] == first && buf[i + len - 1] == last) return i;
+  }
+  return n;
+}
+
+/**
+ * @brief Buckets that may start at buf[i], from the nibble tables.
+ */
+static inline uint8_t teddy_at(const uint8_t (*tables)[16], int fingerprint,
+                               const char *buf, size_t i) {
+  uint8_t c = buf[i];
+  uint8_t b = tables[0][c & 15] & tables[1][c >> 4];
+  if (fingerprint > 1) {
+    c = buf[i + 1];
+    b &= tables[2][c & 15] & tables[3][c >> 4];
+  }
+  return b;
+}
+
+static size_t teddy_scalar(const uint8_t (*tables)[16], int fingerprint,
+                           const char *buf, size_t n, size_t from,
+                           uint8_t *buckets) {
+  for (size_t i = from; i + fingerprint <= n; i++) {
+    if ((*buckets = teddy_at(tables, fingerprint, buf, i))) return i;
+  }
+  return n;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static size_t pair_avx2(const char *buf,
+                                                         size_t n, size_t from,
+                                                         char first, char last,
+                                                         size_t len) {
+  const __m256i f = _mm256_set1_epi8(first), l = _mm256_set1_epi8(last);
+  size_t i = from;
+  for (; i + len - 1 + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + len - 1));
+    uint32_t mask = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return pair_scalar(buf, n, i, first, last, len);
+}
+
+static size_t pair_sse2(const char *buf, size_t n, size_t from, char first,
+                        char last, size_t len) {
+  const __m128i f = _mm_set1_epi8(first), l = _mm_set1_epi8(last);
+  size_t i = from;
+  for (; i + len - 1 + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(buf + i + len - 1));
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return pair_scalar(buf, n, i, first, last, len);
+}
+
+__attribute__((target("avx2"))) static size_t teddy_avx2(
+    const uint8_t (*tables)[16], int fingerprint, const char *buf, size_t n,
+    size_t from, uint8_t *buckets) {
+  __m256i t[4];
+  for (int k = 0; k < 4; k++) {
+    t[k] = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *)tables[k]));
+  }
+  const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+  size_t i = from;
+  for (; i + fingerprint - 1 + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i r = _mm256_and_si256(
+        _mm256_shuffle_epi8(t[0], _mm256_and_si256(v, nibble)),
+        _mm256_shuffle_epi8(
+            t[1], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+    if (fingerprint > 1) {
+      v = _mm256_loadu_si256((const __m256i *)(buf + i + 1));
+      r = _mm256_and_si256(
+          r, _mm256_and_si256(
+                 _mm256_shuffle_epi8(t[2], _mm256_and_si256(v, nibble)),
+                 _mm256_shuffle_epi8(
+                     t[3], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble))));
+    }
+    uint32_t mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero));
+    if (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      *buckets = teddy_at(tables, fingerprint, buf, at);
+      return at;
+    }
+  }
+  return teddy_scalar(tables, fingerprint, buf, n, i, buckets);
+}
+
+__attribute__((target("ssse3"))) static size_t teddy_ssse3(
+    const uint8_t (*tables)[16], int fingerprint, const char *buf, size_t n,
+    size_t from, uint8_t *buckets) {
+  __m128i t[4];
+  for (int k = 0; k < 4; k++) t[k] = _mm_load_si128((const __m128i *)tables[k]);
+  const __m128i nibble = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+  size_t i = from;
+  for (; i + fingerprint - 1 + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i r = _mm_and_si128(
+        _mm_shuffle_epi8(t[0], _mm_and_si128(v, nibble)),
+        _mm_shuffle_epi8(t[1], _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+    if (fingerprint > 1) {
+      v = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+      r = _mm_and_si128(
+          r, _mm_and_si128(
+                 _mm_shuffle_epi8(t[2], _mm_and_si128(v, nibble)),
+                 _mm_shuffle_epi8(
+                     t[3], _mm_and_si128(_mm_srli_epi16(v, 4), nibble))));
+    }
+    uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero)) & 0xffff;
+    if (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      *buckets = teddy_at(tables, fingerprint, buf, at);
+      return at;
+    }
+  }
+  return teddy_scalar(tables, fingerprint, buf, n, i, buckets);
+}
+#endif
+
+typedef size_t (*pair_fn)(const char *, size_t, size_t, char, char, size_t);
+typedef size_t (*teddy_fn)(const uint8_t (*)[16], int, const char *, size_t,
+                           size_t, uint8_t *);
+
+static pair_fn pick_pair() {
+#if defined(__x86_64__)
+  return __builtin_cpu_supports("avx2") ? pair_avx2 : pair_sse2;
+#else
+  return pair_scalar;
+#endif
+}
+
+static teddy_fn pick_teddy() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return teddy_avx2;
+  if (__builtin_cpu_supports("ssse3")) return teddy_ssse3;
+#endif
+  return teddy_scalar;
+}
+
+FixedMatcher::FixedMatcher(const vector<string> &_patterns)
+    : match_all(false), fingerprint(2) {
+  memset(tables, 0, sizeof(tables));
+  // grep -F takes each line of a pattern as a pattern of its own
+  for (const string &pattern : _patterns) {
+    size_t start = 0;
+    while (true) {
+      size_t nl = pattern.find('\n', start);
+      patterns.push_back(pattern.substr(start, nl - start));
+      if (nl == string::npos) break;
+      start = nl + 1;
+    }
+  }
+  for (const string &pattern : patterns) {
+    if (pattern.empty()) match_all = true;
+    if (pattern.size() == 1) fingerprint = 1;
+  }
+  for (size_t id = 0; id < patterns.size(); id++) {
+    int bucket = id % TEDDY_BUCKETS;
+    buckets[bucket].push_back(id);
+    for (int k = 0; k < fingerprint && k < (int)patterns[id].size(); k++) {
+      uint8_t c = patterns[id][k];
+      tables[2 * k][c & 15] |= 1 << bucket;
+      tables[2 * k + 1][c >> 4] |= 1 << bucket;
+    }
+  }
+  if (fingerprint == 1) {
+    // the second byte is not checked
+    memset(tables[2], 0xff, 32);
+  }
+}
+
+bool FixedMatcher::verify(const char *buf, size_t n, size_t at,
+                          uint8_t found) const {
+  for (int b = 0; b < TEDDY_BUCKETS; b++) {
+    if (!(found & (1 << b))) continue;
+    for (int id : buckets[b]) {
+      const string &pattern = patterns[id];
+      if (at + pattern.size() <= n &&
+          memcmp(buf + at, pattern.data(), pattern.size()) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t FixedMatcher::find(const char *buf, size_t n) const {
+  if (match_all) return 0;
+  if (patterns.size() == 1) {
+    const string &pattern = patterns[0];
+    if (pattern.size() == 1) {
+      const char *hit = (const char *)memchr(buf, pattern[0], n);
+      return hit ? hit - buf : n;
+    }
+    static const pair_fn pair = pick_pair();
+    for (size_t at = 0;; at++) {
+      at = pair(buf, n, at, pattern[0], pattern.back(), pattern.size());
+      if (at == n) return n;
+      if (memcmp(buf + at + 1, pattern.data() + 1, pattern.size() - 2) == 0) {
+        return at;
+      }
+    }
+  }
+  static const teddy_fn teddy = pick_teddy();
+  for (size_t at = 0;; at++) {
+    uint8_t found;
+    at = teddy(tables, fingerprint, buf, n, at, &found);
+    if (at == n) return n;
+    if (verify(buf, n, at, found)) return at;
+  }
+}
+
+/**
+ * @brief Selects lines of one input and formats them.
+ */
+struct GrepRun {
+  const FixedMatcher *matcher;
+  bool invert, count, number, quiet;
+  string prefix;
+  int out_fd;
+
+  size_t selected;
+  size_t line_no;
+  string out;
+
+  /**
+   * @brief Selects lines[0, n), all ending in '\n'; the first of them is
+   * line number first.
+   */
+  void emit(const char *lines, size_t n, size_t first) {
+    selected += count_byte(lines, n, '\n');
+    if (count || quiet) return;
+    if (!number && prefix.empty()) {
+      out.append(lines, n);
+      return;
+    }
+    for (const char *line = lines; line < lines + n; first++) {
+      const char *end = (const char *)memchr(line, '\n', lines + n - line) + 1;
+      out += prefix;
+      if (number) out += to_string(first) + ":";
+      out.append(line, end - line);
+      line = end;
+    }
+  }
+
+  /**
+   * @brief Processes whole lines. Between matches nothing is looked at but
+   * the matcher, and runs of lines are written in bulk.
+   * @return false if output failed.
+   */
+  bool process(const char *buf, size_t n) {
+    for (size_t at = 0; at < n;) {
+      size_t hit = at + matcher->find(buf + at, n - at);
+      if (hit == n) {
+        if (invert) emit(buf + at, n - at, line_no);
+        line_no += count_byte(buf + at, n - at, '\n');
+        break;
+      }
+      const char *nl = (const char *)memrchr(buf + at, '\n', hit - at);
+      size_t start = nl ? nl - buf + 1 : at;
+      size_t end = (const char *)memchr(buf + hit, '\n', n - hit) - buf + 1;
+      size_t before = count_byte(buf + at, start - at, '\n');
+      if (invert) {
+        emit(buf + at, start - at, line_no);
+      } else {
+        emit(buf + start, end - start, line_no + before);
+      }
+      line_no += before + 1;
+      at = end;
+      if (quiet && selected) return true;
+    }
+    if (out.size() >= GREP_OUT_FLUSH) return flush();
+    return true;
+  }
+
+  bool flush() {
+    bool ok = write_all(out_fd, out.data(), out.size()) == 0;
+    out.clear();
+    return ok;
+  }
+};
+
+/**
+ * @brief Whether pattern means the same as a basic regular expression and
+ * as a fixed string.
+ */
+static bool is_literal(const string &pattern) {
+  return pattern.find_first_of(".[]*^$\\") == string::npos;
+}
+
+int builtin_grep(Process *p, int in_fd, int out_fd, int err_fd) {
+  bool fixed = false, invert = false, count = false, number = false,
+       quiet = false;
+  vector<string> patterns;
+  vector<const char *> operands;
+  bool options_done = false;
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *tok = p->cmdTokens[i];
+    if (options_done || tok[0] != '-' || !tok[1]) {
+      operands.push_back(tok);
+      continue;
+    }
+    if (strcmp(tok, "--") == 0) {
+      options_done = true;
+      continue;
+    }
+    for (const char *c = tok + 1; *c; c++) {
+      if (*c == 'F') {
+        fixed = true;
+      } else if (*c == 'v') {
+        invert = true;
+      } else if (*c == 'c') {
+        count = true;
+      } else if (*c == 'n') {
+        number = true;
+      } else if (*c == 'q') {
+        quiet = true;
+      } else if (*c == 'e') {
+        const char *value = c[1] ? c + 1 : p->cmdTokens[++i];
+        if (!value) return run_external(p, in_fd, out_fd, err_fd);
+        patterns.push_back(value);
+        break;
+      } else {
+        return run_external(p, in_fd, out_fd, err_fd);
+      }
+    }
+  }
+  if (patterns.empty()) {
+    if (operands.empty()) return run_external(p, in_fd, out_fd, err_fd);
+    patterns.push_back(operands[0]);
+    operands.erase(operands.begin());
+  }
+  if (!fixed) {
+    for (const string &pattern : patterns) {
+      if (!is_literal(pattern)) return run_external(p, in_fd, out_fd, err_fd);
+    }
+  }
+
+  FixedMatcher matcher(patterns);
+  bool stdin_only = operands.empty();
+  if (stdin_only) operands.push_back("-");
+  vector<char> buf(GREP_BUF_SIZE);
+  size_t total = 0;
+  int status = 0;
+  for (const char *file : operands) {
+    int fd = in_fd;
+    if (strcmp(file, "-") != 0) {
+      fd = open(file, O_RDONLY | O_CLOEXEC);
+      if (fd == -1) {
+        if (!quiet) {
+          dprintf(err_fd, "tsh: grep: %s: %s\n", file, strerror(errno));
+        }
+        status = 2;
+        continue;
+      }
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    GrepRun run = {&matcher, invert, count, number, quiet,
+                   operands.size() > 1 ? string(stdin_only ? "(standard input)"
+                                                           : file) + ":"
+                                       : "",
+                   out_fd, 0, 1, ""};
+    size_t have = 0;
+    bool ok = true;
+    while (ok && !(quiet && run.selected)) {
+      if (have == buf.size()) buf.resize(buf.size() * 2);
+      ssize_t n = read(fd, buf.data() + have, buf.size() - have);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        dprintf(err_fd, "tsh: grep: %s: %s\n", file, strerror(errno));
+        status = 2;
+        break;
+      }
+      if (n == 0) {
+        // a last line without a newline is still a line
+        if (have > 0) {
+          buf.resize(max(buf.size(), have + 1));
+          buf[have++] = '\n';
+          ok = run.process(buf.data(), have);
+        }
+        break;
+      }
+      have += n;
+      const char *last = (const char *)memrchr(buf.data(), '\n', have);
+      if (!last) continue;
+      size_t whole = last - buf.data() + 1;
+      ok = run.process(buf.data(), whole);
+      memmove(buf.data(), buf.data() + whole, have - whole);
+      have -= whole;
+    }
+    if (fd != in_fd) close(fd);
+    if (ok && count) {
+      run.out += run.prefix + to_string(run.selected) + "\n";
+    }
+    if (!ok || !run.flush()) return write_error_status(errno);
+    total += run.selected;
+    if (quiet && total) return 0;
+  }
+  if (status) return status;
+  return total ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+#include <fcntl.h>
+#include <history.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <unordered_set>
+
+using namespace std;
+
+/**
+ * @brief Hashes the trigram at s into one of the index buckets.
+ */
+static inline uint32_t trigram_bucket(const char *s) {
+  uint32_t t = ((uint8_t)s[0] << 16) | ((uint8_t)s[1] << 8) | (uint8_t)s[2];
+  return (t * 2654435761u) >> (32 - HISTORY_INDEX_BITS);
+}
+
+static void put_varint(vector<uint8_t> &out, uint32_t v) {
+  while (v >= 0x80) {
+    out.push_back((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  out.push_back(v);
+}
+
+/**
+ * @brief Opens (creating if needed) and maps the history file.
+ *
+ * The maintenance thread is started last, once the snapshot is in place.
+ */
+History::History(const string &_path, size_t _max_entries)
+    : path(_path),
+      max_entries(_max_entries),
+      map(nullptr),
+      map_len(0),
+      index_ready(false),
+      stopping(false) {
+  fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  lock_fd = open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  struct stat st;
+  if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      map = (char *)m;
+      map_len = st.st_size;
+      madvise(map, map_len, MADV_DONTFORK);
+    }
+  }
+  maintenance = thread(&History::maintain, this);
+}
+
+History::~History() {
+  stopping = true;
+  if (maintenance.joinable()) maintenance.join();
+  if (map) munmap(map, map_len);
+  if (fd != -1) close(fd);
+  if (lock_fd != -1) close(lock_fd);
+}
+
+void History::sync() {
+  if (maintenance.joinable()) maintenance.join();
+}
+
+/**
+ * @brief Re-opens the file if compaction replaced it since it was opened.
+ *
+ * Must be called with the lock file held, so no compaction is in progress.
+ */
+bool History::reopen_if_replaced() {
+  struct stat ours, current;
+  if (fd != -1 && fstat(fd, &ours) == 0 && stat(path.c_str(), &current) == 0 &&
+      ours.st_ino == current.st_ino && ours.st_dev == current.st_dev) {
+    return true;
+  }
+  if (fd != -1) close(fd);
+  fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  return fd != -1;
+}
+
+void History::add(const char *line) {
+  if (!line || !*line) return;
+  string entry = line;
+  {
+    lock_guard<mutex> guard(lock);
+    added.push_back(entry);
+  }
+  entry += '\n';
+
+  // a shared lock lets sessions append concurrently but not during compaction
+  if (lock_fd != -1) flock(lock_fd, LOCK_SH);
+  if (reopen_if_replaced()) {
+    ssize_t n;
+    while ((n = write(fd, entry.data(), entry.size())) == -1 && errno == EINTR) {
+    }
+  }
+  if (lock_fd != -1) flock(lock_fd, LOCK_UN);
+}
+
+/**
+ * @brief Returns the mapped entry spanning [start, end), without its newline.
+ */
+string History::mapped_entry(size_t start, size_t end) {
+  if (end > start && map[end - 1] == '\n') end--;
+  return string(map + start, end - start);
+}
+
+bool History::recent(size_t k, string *out) {
+  lock_guard<mutex> guard(lock);
+  if (k < added.size()) {
+    *out = added[added.size() - 1 - k];
+    return true;
+  }
+  k -= added.size();
+
+  // extend the backward scan until entry k is known
+  while (tail.size() <= k) {
+    size_t end = tail.empty() ? map_len : tail.back();
+    // skip the newline that ends the previous entry
+    if (end == 0) return false;
+    size_t search_end = end - 1;
+    char *nl = search_end ? (char *)memrchr(map, '\n', search_end) : NULL;
+    tail.push_back(nl ? nl - map + 1 : 0);
+  }
+  size_t end = k == 0 ? map_len : tail[k - 1];
+  *out = mapped_entry(tail[k], end);
+  return true;
+}
+
+vector<string> History::search(const char *pattern, size_t limit) {
+  vector<string> results;
+  unordered_set<string> seen;
+  size_t plen = strlen(pattern);
+  auto consider = [&](const char *s, size_t len) {
+    if (len >= plen && memmem(s, len, pattern, plen)) {
+      string entry(s, len);
+      if (seen.insert(entry).second) results.push_back(entry);
+    }
+    return results.size() < limit;
+  };
+
+  lock_guard<mutex> guard(lock);
+  for (size_t i = added.size(); i-- > 0;) {
+    if (!consider(added[i].data(), added[i].size())) return results;
+  }
+  if (!map) return results;
+
+  if (index_ready && plen >= 3) {
+    // only entries holding the pattern's rarest trigram can match
+    uint32_t best = trigram_bucket(pattern);
+    for (size_t i = 1; i + 3 <= plen; i++) {
+      uint32_t b = trigram_bucket(pattern + i);
+      if (counts[b] < counts[best]) best = b;
+    }
+    vector<uint32_t> ids;
+    ids.reserve(counts[best]);
+    const uint8_t *list = postings.data();
+    uint32_t id = 0;
+    for (size_t i = bucket_start[best]; i < bucket_start[best + 1];) {
+      uint32_t delta = 0;
+      int shift = 0;
+      while (list[i] & 0x80) {
+        delta |= (list[i++] & 0x7f) << shift;
+        shift += 7;
+      }
+      delta |= list[i++] << shift;
+      id += delta;
+      ids.push_back(id);
+    }
+    for (size_t i = ids.size(); i-- > 0;) {
+      size_t start = offsets[ids[i]];
+      size_t end = ids[i] + 1 < offsets.size() ? offsets[ids[i] + 1] : map_len;
+      if (end > start && map[end - 1] == '\n') end--;
+      if (!consider(map + start, end - start)) break;
+    }
+    return results;
+  }
+
+  // no index yet: scan backwards from the newest mapped entry
+  size_t end = map_len;
+  while (end > 0) {
+    size_t line_end = map[end - 1] == '\n' ? end - 1 : end;
+    char *nl = line_end ? (char *)memrchr(map, '\n', line_end) : NULL;
+    size_t start = nl ? nl - map + 1 : 0;
+    if (!consider(map + start, line_end - start)) break;
+    end = start;
+  }
+  return results;
+}
+
+/**
+ * @brief Background work: index the snapshot, then compact the file if it
+ * grew past max_entries.
+ */
+void History::maintain() {
+  if (map) build_index();
+  if (!stopping && offsets.size() > max_entries) compact();
+}
+
+/**
+ * @brief Builds the trigram index over the mapped snapshot.
+ *
+ * Every bucket holds the ids of the entries containing one of its trigrams
+ * as delta-encoded varints, which keeps the index a few bytes per distinct
+ * trigram per entry even for millions of entries. The buckets are built
+ * separately and then packed into one array.
+ */
+void History::build_index() {
+  forkless_vector<size_t> offs;
+  vector<vector<uint8_t>> lists(1 << HISTORY_INDEX_BITS);
+  forkless_vector<uint32_t> cnts(1 << HISTORY_INDEX_BITS, 0);
+  // last id added to each bucket + 1, to add an entry once per bucket
+  vector<uint32_t> last(1 << HISTORY_INDEX_BITS, 0);
+
+  size_t start = 0;
+  while (start < map_len && !stopping) {
+    char *nl = (char *)memchr(map + start, '\n', map_len - start);
+    size_t end = nl ? nl - map : map_len;
+    uint32_t id = offs.size();
+    offs.push_back(start);
+    for (size_t i = start; i + 3 <= end; i++) {
+      uint32_t b = trigram_bucket(map + i);
+      if (last[b] == id + 1) continue;
+      put_varint(lists[b], cnts[b] ? id - (last[b] - 1) : id);
+      last[b] = id + 1;
+      cnts[b]++;
+    }
+    start = end + 1;
+  }
+  if (stopping) return;
+
+  forkless_vector<size_t> starts(lists.size() + 1, 0);
+  for (size_t b = 0; b < lists.size(); b++) {
+    starts[b + 1] = starts[b] + lists[b].size();
+  }
+  forkless_vector<uint8_t> packed(starts.back());
+  for (size_t b = 0; b < lists.size(); b++) {
+    if (lists[b].empty()) continue;
+    memcpy(packed.data() + starts[b], lists[b].data(), lists[b].size());
+    vector<uint8_t>().swap(lists[b]);
+  }
+
+  lock_guard<mutex> guard(lock);
+  offsets.swap(offs);
+  postings.swap(packed);
+  bucket_start.swap(starts);
+  counts.swap(cnts);
+  index_ready = true;
+}
+
+/**
+ * @brief Rewrites the file without duplicates and with at most max_entries
+ * entries, keeping the newest.
+ *
+ * The new file is written next to the old one and renamed over it while the
+ * lock file is held exclusively, so no append can land in the old file.
+ */
+void History::compact() {
+  if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) return;
+  int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (in == -1 || fstat(in, &st) == -1 || st.st_size == 0) {
+    if (in != -1) close(in);
+    flock(lock_fd, LOCK_UN);
+    return;
+  }
+  char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+  close(in);
+  if (data == MAP_FAILED) {
+    flock(lock_fd, LOCK_UN);
+    return;
+  }
+
+  // walk newest to oldest, keeping the first (newest) copy of each entry
+  vector<pair<size_t, size_t>> keep;
+  unordered_set<string> seen;
+  size_t end = st.st_size;
+  while (end > 0 && keep.size() < max_entries) {
+    size_t line_end = data[end - 1] == '\n' ? end - 1 : end;
+    char *nl = line_end ? (char *)memrchr(data, '\n', line_end) : NULL;
+    size_t start = nl ? nl - data + 1 : 0;
+    if (line_end > start &&
+        seen.insert(string(data + start, line_end - start)).second) {
+      keep.push_back({start, line_end - start});
+    }
+    end = start;
+  }
+
+  string tmp = path + ".tmp";
+  int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  bool ok = out != -1;
+  string buf;
+  for (size_t i = keep.size(); ok && i-- > 0;) {
+    buf.append(data + keep[i].first, keep[i].second);
+    buf += '\n';
+    if (buf.size() >= (1 << 20) || i == 0) {
+      ok = write(out, buf.data(), buf.size()) == (ssize_t)buf.size();
+      buf.clear();
+    }
+  }
+  munmap(data, st.st_size);
+  if (out != -1) {
+    ok = ok && fsync(out) == 0;
+    close(out);
+  }
+  if (ok) {
+    rename(tmp.c_str(), path.c_str());
+  } else {
+    unlink(tmp.c_str());
+  }
+  flock(lock_fd, LOCK_UN);
+}
+
+History *shell_history() {
+  static History *history = nullptr;
+  static bool initialized = false;
+  if (!initialized) {
+    initialized = true;
+    if (!isatty(STDIN_FILENO)) return nullptr;
+    const char *file = getenv("TSH_HISTFILE");
+    const char *home = getenv("HOME");
+    string path;
+    if (file) {
+      path = file;
+    } else if (home) {
+      path = string(home) + "/.tsh_history";
+    } else {
+      return nullptr;
+    }
+    const char *size = getenv("TSH_HISTSIZE");
+    history = new History(path, size ? strtoul(size, NULL, 10)
+                                     : HISTORY_MAX_ENTRIES);
+  }
+  return history;
+}
+
+int builtin_history(Process *p, int, int out_fd, int err_fd) {
+  History *history = shell_history();
+  if (!history) {
+    dprintf(err_fd, "tsh: history: not available\n");
+    return 1;
+  }
+
+  if (p->cmdTokens[1] && strcmp(p->cmdTokens[1], "-s") == 0) {
+    if (!p->cmdTokens[2]) {
+      dprintf(err_fd, "tsh: history: -s needs a pattern\n");
+      return 2;
+    }
+    for (const string &entry : history->search(p->cmdTokens[2], SIZE_MAX)) {
+      dprintf(out_fd, "%s\n", entry.c_str());
+    }
+    return 0;
+  }
+
+  size_t count = p->cmdTokens[1] ? strtoul(p->cmdTokens[1], NULL, 10)
+                                 : SIZE_MAX;
+  vector<string> entries;
+  string entry;
+  while (entries.size() < count && history->recent(entries.size(), &entry)) {
+    entries.push_back(entry);
+  }
+  string out;
+  for (size_t i = entries.size(); i-- > 0;) {
+    out += entries[i];
+    out += '\n';
+  }
+  ssize_t n = write(out_fd, out.data(), out.size());
+  return n == (ssize_t)out.size() ? 0 : 1;
+}
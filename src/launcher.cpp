@@ -0,0 +1,227 @@
+#include <alias.h>
+#include <builtins.h>
+#include <fcntl.h>
+#include <launcher.h>
+#include <pathcache.h>
+#include <qos.h>
+#include <signal.h>
+#include <topology.h>
+
+using namespace std;
+
+PosixLauncher::PosixLauncher() : next_thread(-2) {}
+
+/**
+ * @brief Creates a close-on-exec pipe.
+ *
+ * Close-on-exec keeps every pipe end out of the exec'd children except the
+ * ones dup2'd onto their stdin/stdout, so a writer is never kept alive by a
+ * stray copy of its own read end.
+ */
+int PosixLauncher::make_pipe(int fd[2]) { return pipe2(fd, O_CLOEXEC); }
+
+/**
+ * @brief Pins and demotes a forked child and moves the given descriptors
+ * onto its stdin, stdout and stderr.
+ */
+static void set_up_child(int in_fd, int out_fd, int err_fd, int cpu,
+                         QosClass qos) {
+  pin_to_cpu(cpu);
+  apply_qos(qos);
+  // dup2 onto itself would keep the close-on-exec flag, so clear it
+  // explicitly in that case
+  if (in_fd == STDIN_FILENO) fcntl(in_fd, F_SETFD, 0);
+  else if (in_fd != -1) dup2(in_fd, STDIN_FILENO);
+  if (out_fd == STDOUT_FILENO) fcntl(out_fd, F_SETFD, 0);
+  else if (out_fd != -1) dup2(out_fd, STDOUT_FILENO);
+  if (err_fd == STDERR_FILENO) fcntl(err_fd, F_SETFD, 0);
+  else if (err_fd != -1) dup2(err_fd, STDERR_FILENO);
+}
+
+/**
+ * @brief Runs builtin for p in a forked child, which closes every other
+ * descriptor of the shell first as a call does.
+ */
+pid_t PosixLauncher::fork_builtin(Process *p, const Builtin *builtin,
+                                  int in_fd, int out_fd, int err_fd,
+                                  int cpu) {
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+  set_up_child(in_fd, out_fd, err_fd, cpu, (QosClass)p->qos);
+  close_range(3, ~0U, 0);
+  _exit(builtin->fn(p, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO));
+}
+
+/**
+ * @brief Forks and execs p with the given stdin, stdout and stderr.
+ *
+ * The executable is resolved through the PATH cache before forking, so the
+ * child execs it directly instead of probing every $PATH directory. If the
+ * cached file is gone the child falls back to execvp.
+ *
+ * A builtin runs on a new thread instead, and so does a function call whose
+ * body only runs builtins (see call_builtin()); any other call runs its
+ * body in the child. Its descriptors are duplicated
+ * first, because the caller closes its pipe ends as soon as the job is
+ * launched; the thread closes the copies when the builtin returns, which is
+ * what gives the next stage its end of file. SIGPIPE is blocked on the
+ * thread, so writing to a closed pipe fails with EPIPE instead of killing the
+ * shell.
+ *
+ * Those copies stay open in the shell for as long as the builtin runs, and
+ * the thread's stack stays mapped until its job is waited for, which every
+ * later fork has to copy. So once BUILTIN_THREADS builtin jobs are waiting,
+ * a builtin runs in a forked child instead, like a call: a pipeline of
+ * thousands of builtins then keeps a bounded number of descriptors and
+ * stacks in the shell, and launching each stage costs the same.
+ *
+ * With $TSH_AFFINITY=cache each stage, child or thread, is pinned to the cpu
+ * place_stage() picks, so stages talking through a pipe share a cache. The
+ * stage's QoS class is applied the same way.
+ *
+ * @return The child's pid or the builtin's (negative) job id, or -1 if the
+ * job could not be started.
+ */
+pid_t PosixLauncher::launch(Process *p, int in_fd, int out_fd, int err_fd) {
+  const Builtin *builtin =
+      p->call ? call_builtin(p) : find_builtin(p->cmdTokens[0]);
+  int cpu = place_stage(!p->pipe_in);
+  if (builtin && thread_jobs() >= BUILTIN_THREADS) {
+    return fork_builtin(p, builtin, in_fd, out_fd, err_fd, cpu);
+  }
+  if (builtin) {
+    int fds[3] = {in_fd == -1 ? STDIN_FILENO : in_fd,
+                  out_fd == -1 ? STDOUT_FILENO : out_fd,
+                  err_fd == -1 ? STDERR_FILENO : err_fd};
+    for (int i = 0; i < 3; i++) {
+      fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+      if (fds[i] == -1) {
+        while (i-- > 0) close(fds[i]);
+        return -1;
+      }
+    }
+    lock_guard<mutex> guard(lock);
+    pid_t job = next_thread--;
+    threads[job] = async(launch::async, [builtin, p, fds, cpu]() {
+      pin_to_cpu(cpu);
+      apply_qos((QosClass)p->qos);
+      sigset_t set;
+      sigemptyset(&set);
+      sigaddset(&set, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &set, NULL);
+      int code = builtin->fn(p, fds[0], fds[1], fds[2]);
+      for (int fd : fds) close(fd);
+      return (code & 0xff) << 8;
+    });
+    return job;
+  }
+
+  string path = p->call ? "" : path_lookup(p->cmdTokens[0]);
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+  set_up_child(in_fd, out_fd, err_fd, cpu, (QosClass)p->qos);
+
+  // a call runs its body in this child; without an exec, the other
+  // close-on-exec descriptors of the shell have to be closed by hand, or
+  // this child would hold its own pipes open
+  if (p->call) {
+    close_range(3, ~0U, 0);
+    _exit(run_call(p, -1, -1, -1));
+  }
+
+  // execute the command using execv on the cached path, or execvp
+  if (!path.empty()) execv(path.c_str(), p->cmdTokens);
+  execvp(p->cmdTokens[0], p->cmdTokens);
+  // handle errors if the command is invalid.
+  fprintf(stderr, "tsh: %s: %s\n", p->cmdTokens[0], strerror(errno));
+  _exit(127);
+}
+
+size_t PosixLauncher::thread_jobs() {
+  lock_guard<mutex> guard(lock);
+  return threads.size();
+}
+
+void PosixLauncher::close_fd(int fd) { close(fd); }
+
+int PosixLauncher::wait_job(pid_t job) {
+  if (job < -1) {
+    future<int> done;
+    {
+      lock_guard<mutex> guard(lock);
+      auto it = threads.find(job);
+      if (it == threads.end()) return 0;
+      done = move(it->second);
+      threads.erase(it);
+    }
+    return done.get();
+  }
+  int status = 0;
+  while (waitpid(job, &status, 0) == -1 && errno == EINTR) {
+  }
+  return status;
+}
+
+FakeLauncher::FakeLauncher()
+    : now_ns(0), launched(0), open_fds(0), next_job(1), next_fd(1000) {}
+
+void FakeLauncher::set_program(const string &name, long duration_ns,
+                               const string &output, int status,
+                               bool passthrough) {
+  programs[name] = {duration_ns, output, status, passthrough};
+}
+
+int FakeLauncher::make_pipe(int fd[2]) {
+  shared_ptr<string> buf = make_shared<string>();
+  fd[0] = next_fd++;
+  fd[1] = next_fd++;
+  pipes[fd[0]] = buf;
+  pipes[fd[1]] = buf;
+  open_fds += 2;
+  return 0;
+}
+
+/**
+ * @brief Starts a simulated job.
+ *
+ * The job's output is produced immediately: every stage before it in a
+ * pipeline has already been launched, so its input is already in the pipe.
+ */
+pid_t FakeLauncher::launch(Process *p, int in_fd, int out_fd, int) {
+  launched++;
+  Job job = {now_ns, 127 << 8};
+  auto prog = programs.find(p->cmdTokens[0] ? p->cmdTokens[0] : "");
+  if (prog != programs.end()) {
+    string out;
+    auto in = pipes.find(in_fd);
+    if (in != pipes.end()) {
+      if (prog->second.passthrough) out = *in->second;
+      in->second->clear();
+    }
+    out += prog->second.output;
+
+    auto dest = pipes.find(out_fd);
+    if (dest != pipes.end()) {
+      *dest->second += out;
+    } else {
+      stdout_data += out;
+    }
+    job.end_ns = now_ns + prog->second.duration_ns;
+    job.status = (prog->second.status & 0xff) << 8;
+  }
+  jobs[next_job] = job;
+  return next_job++;
+}
+
+void FakeLauncher::close_fd(int fd) {
+  if (pipes.erase(fd)) open_fds--;
+}
+
+int FakeLauncher::wait_job(pid_t job) {
+  auto it = jobs.find(job);
+  if (it == jobs.end()) return 0;
+  now_ns = max(now_ns, it->second.end_ns);
+  int status = it->second.status;
+  jobs.erase(it);
+  return status;
+}
@@ -0,0 +1,93 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <launcher.h>
+#include <libtsh.h>
+
+#include <thread>
+
+using namespace std;
+
+/**
+ * @brief Parses cmd into the pipeline's stages.
+ */
+Pipeline::Pipeline(const char *cmd) { parse_input((char *)cmd, process_list); }
+
+Pipeline::~Pipeline() { cleanup(process_list, nullptr); }
+
+int Pipeline::run(int in_fd, int out_fd, int err_fd) const {
+  // PosixLauncher is thread-safe, so one instance serves every thread
+  static PosixLauncher launcher;
+  int status = 0;
+  run_commands(const_cast<list<Process *> &>(process_list), launcher, in_fd,
+               out_fd, err_fd, &status);
+  return status;
+}
+
+/**
+ * @brief Runs the pipeline between two close-on-exec pipes.
+ *
+ * The input is written and the output read on helper threads while the
+ * pipeline runs, so neither side can fill its pipe and stall the other. The
+ * writer blocks SIGPIPE so a pipeline that stops reading early makes write()
+ * fail with EPIPE instead of killing the host process.
+ */
+int Pipeline::run(const string &input, string *output) const {
+  int in[2], out[2];
+  if (pipe2(in, O_CLOEXEC) == -1) return 127;
+  if (pipe2(out, O_CLOEXEC) == -1) {
+    close(in[0]);
+    close(in[1]);
+    return 127;
+  }
+
+  thread writer([&]() {
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+    size_t done = 0;
+    while (done < input.size()) {
+      ssize_t n = write(in[1], input.data() + done, input.size() - done);
+      // the pipeline may exit without reading all of its input
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      done += n;
+    }
+    close(in[1]);
+    // discard the SIGPIPE raised by an EPIPE write, if any
+    struct timespec zero = {0, 0};
+    while (sigtimedwait(&pipe_set, NULL, &zero) > 0) {
+    }
+  });
+  thread reader([&]() {
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(out[0], buf, sizeof(buf))) != 0) {
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) break;
+      if (output) output->append(buf, n);
+    }
+    close(out[0]);
+  });
+
+  int status = run(in[0], out[1], -1);
+  close(in[0]);
+  close(out[1]);
+  writer.join();
+  reader.join();
+  return status;
+}
+
+future<int> Pipeline::run_async(int in_fd, int out_fd, int err_fd) const {
+  return async(launch::async,
+               [=]() { return run(in_fd, out_fd, err_fd); });
+}
+
+future<int> Pipeline::run_async(const string &input, string *output) const {
+  return async(launch::async, [=]() { return run(input, output); });
+}
+
+void Pipeline::run_async(function<void(int)> done, int in_fd, int out_fd,
+                         int err_fd) const {
+  thread([=]() { done(run(in_fd, out_fd, err_fd)); }).detach();
+}
@@ -0,0 +1,265 @@
+#include <builtins.h>
+#include <launcher.h>
+#include <lineread.h>
+#include <sys/stat.h>
+#include <variables.h>
+
+#include <map>
+
+using namespace std;
+
+// pipes owned by a LineReader, and the buffer shared by their readers;
+// never destroyed, since builtin threads may still be running at exit
+static mutex &owned_lock = *new mutex;
+static map<pair<dev_t, ino_t>, LineBuffer *> &owned =
+    *new map<pair<dev_t, ino_t>, LineBuffer *>;
+
+LineReader::LineReader(int _fd, bool own)
+    : fd(_fd), blocks(false), buffer(&local), owner(false), lent_at(-1) {
+  seekable = lseek(fd, 0, SEEK_CUR) != -1;
+  struct stat st;
+  if (seekable) {
+    blocks = true;
+  } else if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+    pipe_id = {st.st_dev, st.st_ino};
+    lock_guard<mutex> guard(owned_lock);
+    auto it = owned.find(pipe_id);
+    if (it != owned.end()) {
+      buffer = it->second;
+      blocks = true;
+    } else if (own) {
+      owned[pipe_id] = buffer;
+      owner = blocks = true;
+    }
+  }
+}
+
+LineReader::~LineReader() {
+  if (owner) {
+    lock_guard<mutex> guard(owned_lock);
+    owned.erase(pipe_id);
+  }
+  release();
+}
+
+bool LineReader::read_line(string *line) {
+  lock_guard<mutex> guard(buffer->lock);
+  LineBuffer &b = *buffer;
+  line->clear();
+  while (true) {
+    const char *start = b.data.data() + b.at;
+    const char *nl = (const char *)memchr(start, '\n', b.have - b.at);
+    if (nl) {
+      line->append(start, nl);
+      b.at = nl + 1 - b.data.data();
+      return true;
+    }
+    line->append(start, b.have - b.at);
+    b.at = b.have = 0;
+    if (b.eof) return false;
+    size_t want = blocks ? LINE_READ_BLOCK : 1;
+    if (b.data.size() < want) b.data.resize(want);
+    ssize_t n = read(fd, b.data.data(), want);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    // a terminal may see more input after an end of file
+    if (n == 0) {
+      b.eof = seekable || blocks;
+      return false;
+    }
+    b.have = n;
+  }
+}
+
+void LineReader::release() {
+  lend();
+  lent_at = -1;
+  if (seekable) local.at = local.have = 0;
+}
+
+void LineReader::lend() {
+  if (!seekable) return;
+  lent_at = lseek(fd, -(off_t)(local.have - local.at), SEEK_CUR);
+  local.eof = false;
+}
+
+void LineReader::reclaim() {
+  if (lent_at == -1) return;
+  off_t now = lseek(fd, 0, SEEK_CUR);
+  if (now == lent_at) {
+    lseek(fd, local.have - local.at, SEEK_CUR);
+  } else {
+    local.at = local.have = 0;
+  }
+  lent_at = -1;
+}
+
+/**
+ * @brief Reads a line for read: without raw, a backslash at the end joins
+ * the next line.
+ * @return Whether the line was complete.
+ */
+static bool read_logical_line(LineReader &reader, bool raw, string *line) {
+  bool complete = reader.read_line(line);
+  string more;
+  while (!raw && complete) {
+    size_t slashes = 0;
+    size_t n = line->size();
+    while (slashes < n && (*line)[n - 1 - slashes] == '\\') slashes++;
+    if (slashes % 2 == 0) break;
+    line->pop_back();
+    complete = reader.read_line(&more);
+    *line += more;
+  }
+  return complete;
+}
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+/**
+ * @brief Splits line on blanks into the variables names, the last of which
+ * gets the rest of the line, like read does.
+ */
+static void assign_fields(const vector<string> &names, const string &line,
+                          bool raw) {
+  if (names.empty()) {
+    string value;
+    for (size_t i = 0; i < line.size(); i++) {
+      if (!raw && line[i] == '\\' && i + 1 < line.size()) i++;
+      value += line[i];
+    }
+    set_variable("REPLY", value);
+    return;
+  }
+  size_t i = 0;
+  while (i < line.size() && is_blank(line[i])) i++;
+  for (size_t n = 0; n < names.size(); n++) {
+    bool last = n + 1 == names.size();
+    string value;
+    // the length of value up to its last unescaped non-blank
+    size_t keep = 0;
+    for (; i < line.size(); i++) {
+      char c = line[i];
+      if (!raw && c == '\\' && i + 1 < line.size()) {
+        value += line[++i];
+        keep = value.size();
+        continue;
+      }
+      if (is_blank(c) && !last) break;
+      value += c;
+      if (!is_blank(c)) keep = value.size();
+    }
+    value.resize(keep);
+    while (i < line.size() && is_blank(line[i])) i++;
+    set_variable(names[n], value);
+  }
+}
+
+/**
+ * @brief Parses `[-r] [NAME...]` from tokens.
+ * @return false, after reporting it on err_fd, for an unknown option.
+ */
+static bool parse_read(char **tokens, int err_fd, bool *raw,
+                       vector<string> *names) {
+  *raw = false;
+  int i = 1;
+  for (; tokens[i] && tokens[i][0] == '-' && tokens[i][1]; i++) {
+    if (strcmp(tokens[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(tokens[i], "-r") != 0) {
+      dprintf(err_fd, "tsh: read: %s: unsupported option\n", tokens[i]);
+      return false;
+    }
+    *raw = true;
+  }
+  for (; tokens[i]; i++) names->push_back(tokens[i]);
+  return true;
+}
+
+int builtin_read(Process *p, int in_fd, int, int err_fd) {
+  bool raw;
+  vector<string> names;
+  if (!parse_read(p->cmdTokens, err_fd, &raw, &names)) return 2;
+  // nothing else reads a pipe that feeds a pipeline stage
+  LineReader reader(in_fd, p->pipe_in);
+  string line;
+  bool complete = read_logical_line(reader, raw, &line);
+  reader.release();
+  assign_fields(names, line, raw);
+  return complete ? 0 : 1;
+}
+
+int builtin_mapfile(Process *p, int in_fd, int, int err_fd) {
+  bool trim = false;
+  long count = -1, skip = 0;
+  const char *name = "MAPFILE";
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *tok = p->cmdTokens[i];
+    if (strcmp(tok, "-t") == 0) {
+      trim = true;
+    } else if ((strcmp(tok, "-n") == 0 || strcmp(tok, "-s") == 0) &&
+               p->cmdTokens[i + 1]) {
+      char *end;
+      long value = strtol(p->cmdTokens[++i], &end, 10);
+      if (*end || value < 0) {
+        dprintf(err_fd, "tsh: mapfile: %s: invalid count\n", p->cmdTokens[i]);
+        return 2;
+      }
+      (tok[1] == 'n' ? count : skip) = value;
+    } else if (tok[0] == '-') {
+      dprintf(err_fd, "tsh: mapfile: %s: unsupported option\n", tok);
+      return 2;
+    } else {
+      name = tok;
+    }
+  }
+  // -n 0 means no limit
+  if (count == 0) count = -1;
+  // without a count the whole input is read anyway
+  LineReader reader(in_fd, p->pipe_in || count == -1);
+  vector<string> lines;
+  string line;
+  while (count == -1 || (long)lines.size() < count) {
+    bool complete = reader.read_line(&line);
+    if (!complete && line.empty()) break;
+    if (skip > 0) {
+      skip--;
+    } else {
+      if (complete && !trim) line += '\n';
+      lines.push_back(move(line));
+    }
+    if (!complete) break;
+  }
+  reader.release();
+  set_array(name, lines);
+  return 0;
+}
+
+int builtin_while(Process *p, int in_fd, int out_fd, int err_fd) {
+  if (!p->cmdTokens[1] || strcmp(p->cmdTokens[1], "read") != 0 ||
+      p->body.empty()) {
+    dprintf(err_fd,
+            "tsh: while: only `while read ...; do ...; done` is supported\n");
+    return 2;
+  }
+  bool raw;
+  vector<string> names;
+  if (!parse_read(p->cmdTokens + 1, err_fd, &raw, &names)) return 2;
+  // PosixLauncher is thread-safe, so one instance serves every loop
+  static PosixLauncher launcher;
+  // a pipe the shell made for the loop has no other reader; any other pipe
+  // (e.g. the shell's own input) is read without reading ahead
+  LineReader reader(in_fd, p->pipe_in);
+  string line;
+  int status = 0;
+  while (read_logical_line(reader, raw, &line)) {
+    assign_fields(names, line, raw);
+    // the body may read the same input, so it must see what is left of it
+    reader.lend();
+    run_commands(p->body, launcher, in_fd, out_fd, err_fd, &status);
+    reader.reclaim();
+  }
+  return status;
+}
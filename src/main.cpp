@@ -1,11 +1,35 @@
+#include <rc.h>
+#include <record.h>
+#include <server.h>
 #include <tsh.h>
 
 /**
- * @brief the main runner, nothing to do here.
+ * @brief the main runner.
+ *
+ * `tsh_app` runs the interactive shell; `tsh_app -c LINE` runs one command
+ * line and exits with its status; `tsh_app --serve SOCKET` runs the command
+ * server instead (see server.h). The shell and `-c` read the startup file
+ * first (see rc.h), and `--record FILE` before either appends the command
+ * lines they run to FILE (see record.h).
  *
  * @return int
  */
-int main() {
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+    exit(serve(argv[2]));
+  }
+  int arg = 1;
+  if (argc >= 3 && strcmp(argv[1], "--record") == 0) {
+    if (!start_recording(argv[2])) {
+      perror(argv[2]);
+      exit(2);
+    }
+    arg = 3;
+  }
+  load_rc();
+  if (argc == arg + 2 && strcmp(argv[arg], "-c") == 0) {
+    exit(run_line(argv[arg + 1]));
+  }
   run();
   exit(0);
 }
@@ -0,0 +1,58 @@
+#include <pathcache.h>
+#include <sys/stat.h>
+#include <tsh.h>
+
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+static mutex cache_lock;
+static unordered_map<string, string> cache;
+// the $PATH the cached entries were resolved against
+static string cached_path;
+
+/**
+ * @brief Searches the directories of path_env for an executable name.
+ */
+static string search_path(const char *name, const string &path_env) {
+  size_t start = 0;
+  while (start <= path_env.size()) {
+    size_t end = path_env.find(':', start);
+    if (end == string::npos) end = path_env.size();
+    // an empty entry means the current directory
+    string dir = end > start ? path_env.substr(start, end - start) : ".";
+    string candidate = dir + "/" + name;
+    struct stat st;
+    if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+        access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+string path_lookup(const char *name) {
+  if (!name || !*name || strchr(name, '/')) return "";
+  const char *env = getenv("PATH");
+  string path_env = env ? env : "/usr/local/bin:/usr/bin:/bin";
+
+  lock_guard<mutex> guard(cache_lock);
+  if (path_env != cached_path) {
+    cache.clear();
+    cached_path = path_env;
+  }
+  auto it = cache.find(name);
+  if (it != cache.end()) return it->second;
+
+  string found = search_path(name, path_env);
+  // misses are not cached, so newly installed commands are picked up
+  if (!found.empty()) cache[name] = found;
+  return found;
+}
+
+void path_cache_clear() {
+  lock_guard<mutex> guard(cache_lock);
+  cache.clear();
+}
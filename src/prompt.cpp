@@ -0,0 +1,327 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <prompt.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/**
+ * @brief What is known about one git work tree.
+ */
+struct GitState {
+  bool dirty;
+};
+
+// never destroyed: the git worker is detached and still waits on them at exit
+static mutex &state_lock = *new mutex;
+static condition_variable &git_cond = *new condition_variable;
+static int last_status = 0;
+static long last_duration_ms = 0;
+static bool shown = false;
+// width of the prompt currently on screen
+static size_t shown_width = 0;
+static map<string, GitState> git_states;
+// work tree the worker should check next, or "" if none
+static string git_wanted;
+static bool git_worker_started = false;
+
+static void default_redraw(const string &prompt);
+static void (*redraw_hook)(const string &) = default_redraw;
+
+static long now_ms() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t prompt_width(const string &prompt) {
+  size_t width = 0;
+  for (size_t i = 0; i < prompt.size(); i++) {
+    if (prompt[i] == '\033') {
+      // CSI sequences end with a byte in @..~
+      if (i + 1 < prompt.size() && prompt[i + 1] == '[') {
+        i += 2;
+        while (i < prompt.size() && (prompt[i] < '@' || prompt[i] > '~')) i++;
+      }
+      continue;
+    }
+    // count UTF-8 lead bytes only
+    if (((unsigned char)prompt[i] & 0xc0) != 0x80) width++;
+  }
+  return width;
+}
+
+/**
+ * @brief Rewrites the prompt at the start of the line and puts the cursor
+ * back, if that does not shift the text typed after it.
+ */
+static void default_redraw(const string &prompt) {
+  {
+    lock_guard<mutex> guard(state_lock);
+    if (!shown || prompt_width(prompt) != shown_width) return;
+  }
+  string out = "\0337\r" + prompt + "\0338";
+  ssize_t n = write(STDOUT_FILENO, out.data(), out.size());
+  (void)n;
+}
+
+/**
+ * @brief Finds the work tree containing dir and its git directory.
+ * @return false if dir is not inside a git work tree.
+ */
+static bool find_git(string dir, string *root, string *git_dir) {
+  while (!dir.empty()) {
+    string candidate = dir + "/.git";
+    struct stat st;
+    if (stat(candidate.c_str(), &st) == 0) {
+      *root = dir;
+      *git_dir = candidate;
+      if (S_ISREG(st.st_mode)) {
+        // a worktree or submodule: .git holds "gitdir: <path>"
+        ifstream in(candidate);
+        string line;
+        if (getline(in, line) && line.compare(0, 8, "gitdir: ") == 0) {
+          string path = line.substr(8);
+          *git_dir = path[0] == '/' ? path : dir + "/" + path;
+        }
+      }
+      return true;
+    }
+    size_t slash = dir.rfind('/');
+    if (slash == string::npos) break;
+    dir = dir.substr(0, slash);
+  }
+  return false;
+}
+
+/**
+ * @brief Branch name from HEAD, or the short commit id when detached.
+ */
+static string read_branch(const string &git_dir) {
+  ifstream in(git_dir + "/HEAD");
+  string head;
+  if (!getline(in, head)) return "";
+  if (head.compare(0, 16, "ref: refs/heads/") == 0) return head.substr(16);
+  return head.substr(0, 7);
+}
+
+/**
+ * @brief Runs `git status` on root with a timeout.
+ * @return 1 if the work tree is dirty, 0 if clean, -1 if unknown.
+ */
+static int check_dirty(const string &root) {
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC) == -1) return -1;
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(fd[0]);
+    close(fd[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    dup2(fd[1], STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    execlp("git", "git", "-C", root.c_str(), "status", "--porcelain",
+           "--untracked-files=no", (char *)NULL);
+    _exit(127);
+  }
+  close(fd[1]);
+
+  int result = 0;
+  long deadline = now_ms() + PROMPT_GIT_TIMEOUT_MS;
+  char buf[4096];
+  while (true) {
+    long left = deadline - now_ms();
+    struct pollfd pfd = {fd[0], POLLIN, 0};
+    if (left <= 0 || poll(&pfd, 1, left) == 0) {
+      result = -1;
+      break;
+    }
+    ssize_t n = read(fd[0], buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    // any output at all means dirty; no need to wait for the rest
+    result = 1;
+    break;
+  }
+  if (result != 0) kill(pid, SIGKILL);
+  close(fd[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (result == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+    return -1;
+  }
+  return result;
+}
+
+/**
+ * @brief Worker thread: checks the requested work tree and patches the
+ * prompt if its state changed.
+ */
+static void git_worker() {
+  while (true) {
+    string root;
+    {
+      unique_lock<mutex> guard(state_lock);
+      git_cond.wait(guard, []() { return !git_wanted.empty(); });
+      root.swap(git_wanted);
+    }
+    int dirty = check_dirty(root);
+    if (dirty < 0) continue;
+
+    bool changed, redraw;
+    {
+      lock_guard<mutex> guard(state_lock);
+      auto it = git_states.find(root);
+      changed = it == git_states.end() || it->second.dirty != (dirty == 1);
+      git_states[root] = {dirty == 1};
+      redraw = changed && shown;
+    }
+    if (redraw) redraw_hook(render_prompt(prompt_format()));
+  }
+}
+
+/**
+ * @brief The \g segment: branch and cached dirty flag. Queues a fresh check
+ * of the dirty state for the worker.
+ */
+static string git_segment() {
+  char cwd[PATH_MAX];
+  string root, git_dir;
+  if (!getcwd(cwd, sizeof(cwd)) || !find_git(cwd, &root, &git_dir)) return "";
+  string segment = read_branch(git_dir);
+
+  lock_guard<mutex> guard(state_lock);
+  auto it = git_states.find(root);
+  if (it != git_states.end() && it->second.dirty) segment += "*";
+  git_wanted = root;
+  if (!git_worker_started) {
+    git_worker_started = true;
+    thread(git_worker).detach();
+  }
+  git_cond.notify_one();
+  return segment;
+}
+
+static string format_duration(long ms) {
+  char buf[32];
+  if (ms < 1000) {
+    snprintf(buf, sizeof(buf), "%ldms", ms);
+  } else if (ms < 60000) {
+    snprintf(buf, sizeof(buf), "%.1fs", ms / 1000.0);
+  } else {
+    snprintf(buf, sizeof(buf), "%ldm%lds", ms / 60000, ms / 1000 % 60);
+  }
+  return buf;
+}
+
+string render_prompt(const char *format) {
+  string out;
+  int status;
+  long duration;
+  {
+    lock_guard<mutex> guard(state_lock);
+    status = last_status;
+    duration = last_duration_ms;
+  }
+  for (const char *c = format; *c; c++) {
+    if (*c != '\\' || !c[1]) {
+      out += *c;
+      continue;
+    }
+    c++;
+    switch (*c) {
+      case 'w':
+      case 'W': {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) break;
+        string dir = cwd;
+        const char *home = getenv("HOME");
+        if (*c == 'W') {
+          size_t slash = dir.rfind('/');
+          if (slash != string::npos && dir.size() > 1) {
+            dir = dir.substr(slash + 1);
+          }
+        } else if (home && *home && dir.compare(0, strlen(home), home) == 0 &&
+                   (dir.size() == strlen(home) || dir[strlen(home)] == '/')) {
+          dir = "~" + dir.substr(strlen(home));
+        }
+        out += dir;
+        break;
+      }
+      case 'u': {
+        struct passwd *pw = getpwuid(getuid());
+        if (pw) out += pw->pw_name;
+        break;
+      }
+      case 'h': {
+        char host[HOST_NAME_MAX + 1] = "";
+        gethostname(host, sizeof(host));
+        out += string(host).substr(0, string(host).find('.'));
+        break;
+      }
+      case '?':
+        out += to_string(status);
+        break;
+      case 'd':
+        out += format_duration(duration);
+        break;
+      case 'j':
+        out += "0";
+        break;
+      case 'g':
+        out += git_segment();
+        break;
+      case '$':
+        out += getuid() == 0 ? '#' : '$';
+        break;
+      case 'e':
+        out += '\033';
+        break;
+      case '\\':
+        out += '\\';
+        break;
+      default:
+        out += '\\';
+        out += *c;
+    }
+  }
+  return out;
+}
+
+const char *prompt_format() {
+  const char *format = getenv("TSH_PS1");
+  return format ? format : PROMPT_DEFAULT;
+}
+
+void prompt_command_done(int status, long duration_ms) {
+  lock_guard<mutex> guard(state_lock);
+  last_status = status;
+  last_duration_ms = duration_ms;
+}
+
+void prompt_drawn(const string &prompt) {
+  lock_guard<mutex> guard(state_lock);
+  shown = true;
+  shown_width = prompt_width(prompt);
+}
+
+void prompt_done() {
+  lock_guard<mutex> guard(state_lock);
+  shown = false;
+}
+
+void prompt_set_redraw(void (*redraw)(const string &prompt)) {
+  redraw_hook = redraw ? redraw : default_redraw;
+}
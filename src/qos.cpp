@@ -0,0 +1,55 @@
+#include <qos.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+// from linux/ioprio.h, which glibc does not wrap
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+bool parse_qos(const char *name, QosClass *qos) {
+  if (strcmp(name, "normal") == 0) {
+    *qos = QOS_NORMAL;
+  } else if (strcmp(name, "batch") == 0) {
+    *qos = QOS_BATCH;
+  } else if (strcmp(name, "idle") == 0) {
+    *qos = QOS_IDLE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int apply_qos(QosClass qos) {
+  if (qos == QOS_NORMAL) return 0;
+  int result = 0;
+  // on Linux all three act on the calling thread only
+  int nice_value = qos == QOS_IDLE ? QOS_IDLE_NICE : QOS_BATCH_NICE;
+  errno = 0;
+  int current = getpriority(PRIO_PROCESS, 0);
+  if (errno == 0 && current < nice_value &&
+      setpriority(PRIO_PROCESS, 0, nice_value) == -1) {
+    result = -1;
+  }
+  int ioprio = qos == QOS_IDLE
+                   ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+                   : (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | QOS_BATCH_IOPRIO;
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) == -1) {
+    result = -1;
+  }
+  struct sched_param param = {0};
+  if (sched_setscheduler(0, qos == QOS_IDLE ? SCHED_IDLE : SCHED_BATCH,
+                         &param) == -1) {
+    result = -1;
+  }
+  return result;
+}
+
+int builtin_qos(Process *, int, int, int err_fd) {
+  dprintf(err_fd, "tsh: qos: usage: qos normal|batch|idle COMMAND...\n");
+  return 2;
+}
@@ -0,0 +1,327 @@
+#include <alias.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <rc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tsh.h>
+#include <variables.h>
+
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+using namespace std;
+
+// record kinds
+#define RC_SET 's'
+#define RC_EXPORT 'e'
+#define RC_UNSET 'u'
+#define RC_ALIAS 'a'
+#define RC_UNALIAS 'A'
+#define RC_FUNCTION 'f'
+// the value length of `export NAME`, which has none
+#define RC_NO_VALUE UINT32_MAX
+
+/**
+ * @brief One definition: `NAME=VALUE`, `export NAME[=VALUE]`,
+ * `unset NAME`, `alias NAME=VALUE`, `unalias NAME` or a function.
+ */
+struct RcRecord {
+  char kind;
+  string name;
+  string value;
+  bool has_value;
+};
+
+uint64_t rc_hash(const char *data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * @brief Applies records in order, as running their lines would.
+ *
+ * An export is first only set as a shell variable, where later values can
+ * still expand it, and all of them move into the environment together in
+ * flush() (see export_variables()). Anything that depends on where a staged
+ * name lives flushes first.
+ */
+class RcApplier {
+ public:
+  ~RcApplier() { flush(); }
+
+  void apply(char kind, const char *name, const char *value) {
+    // aliases and functions are expanded when they are used
+    if (kind == RC_ALIAS) {
+      set_alias(name, value);
+      return;
+    } else if (kind == RC_UNALIAS) {
+      remove_alias(name);
+      return;
+    } else if (kind == RC_FUNCTION) {
+      set_function(name, value);
+      return;
+    }
+    string expanded;
+    if (value && expand_word(value, &expanded)) value = expanded.c_str();
+    bool is_staged = staged_names.count(name);
+    if (kind == RC_EXPORT) {
+      // a name without a shell variable is skipped by export_variables()
+      if (value) set_variable(name, value);
+      if (!is_staged) {
+        staged.push_back(name);
+        staged_names.insert(name);
+      }
+      return;
+    }
+    if (is_staged) flush();
+    if (kind == RC_SET) {
+      set_variable(name, value ? value : "");
+    } else if (kind == RC_UNSET) {
+      unset_variable(name);
+    }
+  }
+
+  void flush() {
+    export_variables(staged);
+    staged.clear();
+    staged_names.clear();
+  }
+
+ private:
+  vector<string> staged;
+  unordered_set<string> staged_names;
+};
+
+/**
+ * @brief Turns the definitions of one parsed line into records.
+ * @return false if the line does anything else.
+ */
+static bool compile_line(list<Process *> &line, vector<RcRecord> *records) {
+  for (Process *p : line) {
+    if (p->pipe_in || p->pipe_out || !p->body.empty()) return false;
+    char **words = p->cmdTokens;
+    char kind = RC_SET;
+    string name, value;
+    if (alias_definition(p, &name, &value)) {
+      records->push_back({RC_ALIAS, name, value, true});
+      continue;
+    } else if (strcmp(words[0], "function") == 0 && words[1] &&
+               !p->definition.empty()) {
+      records->push_back({RC_FUNCTION, words[1], p->definition, true});
+      continue;
+    } else if (strcmp(words[0], "unalias") == 0) {
+      for (words++; *words; words++) {
+        records->push_back({RC_UNALIAS, *words, "", false});
+      }
+      continue;
+    } else if (strcmp(words[0], "export") == 0 && words[1]) {
+      kind = RC_EXPORT;
+      words++;
+    } else if (strcmp(words[0], "unset") == 0 &&
+               !(words[1] && strcmp(words[1], "-f") == 0)) {
+      kind = RC_UNSET;
+      words++;
+    } else if (!is_assignment_list(p)) {
+      return false;
+    }
+    for (; *words; words++) {
+      const char *eq = strchr(*words, '=');
+      if (kind == RC_UNSET || (kind == RC_EXPORT && !eq)) {
+        // names only; a bad one is left for the builtin to report
+        if (eq || !is_assignment((string(*words) + "=").c_str())) {
+          return false;
+        }
+        records->push_back({kind, *words, "", false});
+      } else {
+        if (!is_assignment(*words)) return false;
+        records->push_back(
+            {kind, string((const char *)*words, eq), eq + 1, true});
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief The lines of text worth running: not blank and not a comment.
+ */
+static vector<string> rc_lines(const string &text) {
+  vector<string> lines;
+  istringstream in(text);
+  string line;
+  while (getline(in, line)) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == string::npos || line[start] == '#') continue;
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+/**
+ * @brief Parses text into records.
+ * @return false if text runs anything but definitions.
+ */
+static bool compile_rc(const string &text, vector<RcRecord> *records) {
+  for (const string &line : rc_lines(text)) {
+    list<Process *> process_list;
+    char *input_line = strdup(line.c_str());
+    parse_input(input_line, process_list);
+    bool ok = compile_line(process_list, records);
+    cleanup(process_list, input_line);
+    if (!ok) return false;
+  }
+  return true;
+}
+
+static void put_u32(string &out, uint32_t v) {
+  out.append((const char *)&v, sizeof(v));
+}
+
+/**
+ * @brief Writes records as the snapshot at path, atomically: readers see
+ * the old file or the complete new one.
+ */
+static void write_snapshot(const string &path, uint64_t hash,
+                           const vector<RcRecord> &records) {
+  string data(RC_SNAPSHOT_MAGIC, RC_SNAPSHOT_MAGIC_LEN);
+  data.append((const char *)&hash, sizeof(hash));
+  put_u32(data, records.size());
+  for (const RcRecord &r : records) {
+    data += r.kind;
+    put_u32(data, r.name.size());
+    put_u32(data, r.has_value ? r.value.size() : RC_NO_VALUE);
+    // each string ends in a '\0', so records apply straight from the map
+    data.append(r.name.c_str(), r.name.size() + 1);
+    if (r.has_value) data.append(r.value.c_str(), r.value.size() + 1);
+  }
+  string tmp = path + ".tmp" + to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) return;
+  bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) == -1) unlink(tmp.c_str());
+}
+
+/**
+ * @brief Maps the snapshot at path and applies its records.
+ * @return false, having applied nothing, if there is no valid snapshot of
+ * the file with this hash.
+ */
+static bool apply_snapshot(const string &path, uint64_t hash) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  struct stat st;
+  void *m = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (m == MAP_FAILED) return false;
+  const char *at = (const char *)m, *end = at + st.st_size;
+  uint64_t file_hash;
+  uint32_t count;
+  // check every record before applying any, so a damaged snapshot is
+  // rebuilt instead of applied in part
+  vector<const char *> records;
+  bool ok = end - at >= RC_SNAPSHOT_MAGIC_LEN + 12 &&
+            memcmp(at, RC_SNAPSHOT_MAGIC, RC_SNAPSHOT_MAGIC_LEN) == 0;
+  if (ok) {
+    memcpy(&file_hash, at + RC_SNAPSHOT_MAGIC_LEN, sizeof(file_hash));
+    memcpy(&count, at + RC_SNAPSHOT_MAGIC_LEN + 8, sizeof(count));
+    ok = file_hash == hash;
+    at += RC_SNAPSHOT_MAGIC_LEN + 12;
+  }
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint32_t name_len, value_len;
+    if (end - at < 9) {
+      ok = false;
+      break;
+    }
+    memcpy(&name_len, at + 1, 4);
+    memcpy(&value_len, at + 5, 4);
+    size_t size = 9 + (size_t)name_len + 1 +
+                  (value_len == RC_NO_VALUE ? 0 : (size_t)value_len + 1);
+    ok = (size_t)(end - at) >= size;
+    if (ok) records.push_back(at);
+    at += size;
+  }
+  if (ok) {
+    RcApplier applier;
+    for (const char *r : records) {
+      uint32_t name_len, value_len;
+      memcpy(&name_len, r + 1, 4);
+      memcpy(&value_len, r + 5, 4);
+      const char *name = r + 9;
+      applier.apply(r[0], name,
+                    value_len == RC_NO_VALUE ? nullptr : name + name_len + 1);
+    }
+  }
+  munmap(m, st.st_size);
+  return ok;
+}
+
+/**
+ * @brief Removes the snapshots in cache_dir other than keep.
+ */
+static void remove_old_snapshots(const string &cache_dir, const string &keep) {
+  DIR *dir = opendir(cache_dir.c_str());
+  if (!dir) return;
+  while (struct dirent *e = readdir(dir)) {
+    string name = e->d_name;
+    if (name.compare(0, 3, "rc-") == 0 && name != keep &&
+        name.size() > 5 && name.compare(name.size() - 5, 5, ".snap") == 0) {
+      unlink((cache_dir + "/" + name).c_str());
+    }
+  }
+  closedir(dir);
+}
+
+RcLoad load_rc(const string &path, const string &cache_dir) {
+  ifstream in(path, ios::binary);
+  if (!in) return RC_NONE;
+  string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  uint64_t hash = rc_hash(text.data(), text.size());
+  char name[32];
+  snprintf(name, sizeof(name), "rc-%016llx.snap", (unsigned long long)hash);
+  string snapshot = cache_dir.empty() ? "" : cache_dir + "/" + name;
+  if (!snapshot.empty() && apply_snapshot(snapshot, hash)) return RC_MAPPED;
+
+  vector<RcRecord> records;
+  if (!compile_rc(text, &records)) {
+    for (const string &line : rc_lines(text)) run_line(line.c_str());
+    return RC_RAN;
+  }
+  if (!snapshot.empty()) {
+    // the parent too, for a fresh ~/.cache
+    mkdir(cache_dir.substr(0, cache_dir.rfind('/')).c_str(), 0700);
+    mkdir(cache_dir.c_str(), 0700);
+    write_snapshot(snapshot, hash, records);
+    remove_old_snapshots(cache_dir, name);
+  }
+  RcApplier applier;
+  for (const RcRecord &r : records) {
+    applier.apply(r.kind, r.name.c_str(),
+                  r.has_value ? r.value.c_str() : nullptr);
+  }
+  return RC_COMPILED;
+}
+
+RcLoad load_rc() {
+  const char *home = getenv("HOME");
+  const char *env = getenv("TSH_RC");
+  string path = env ? env : home ? string(home) + "/.tshrc" : "";
+  if (path.empty()) return RC_NONE;
+  string cache_dir;
+  if (const char *xdg = getenv("XDG_CACHE_HOME")) {
+    cache_dir = string(xdg) + "/tsh";
+  } else if (home) {
+    cache_dir = string(home) + "/.cache/tsh";
+  }
+  return load_rc(path, cache_dir);
+}
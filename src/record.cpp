@@ -0,0 +1,229 @@
+#include <fcntl.h>
+#include <record.h>
+#include <tsh.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+
+using namespace std;
+
+static void put_varint(string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out += (char)((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  out += (char)v;
+}
+
+static void put_string(string &out, const string &s) {
+  put_varint(out, s.size());
+  out += s;
+}
+
+static vector<pair<string, string>> relevant_env() {
+  vector<pair<string, string>> env;
+  for (const char *name : RECORD_ENV) {
+    if (const char *value = getenv(name)) env.push_back({name, value});
+  }
+  return env;
+}
+
+static string current_dir() {
+  char buf[PATH_MAX];
+  return getcwd(buf, sizeof(buf)) ? buf : "";
+}
+
+SessionRecorder::SessionRecorder(const string &path)
+    : id(getpid()), last_start_ns(0) {
+  fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) return;
+  last_start_ns = chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::system_clock::now().time_since_epoch())
+                      .count();
+  string rec = "S";
+  put_varint(rec, id);
+  rec.append(RECORD_MAGIC, RECORD_MAGIC_LEN);
+  put_varint(rec, last_start_ns);
+  if (write(fd, rec.data(), rec.size()) != (ssize_t)rec.size()) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+SessionRecorder::~SessionRecorder() {
+  if (fd != -1) close(fd);
+}
+
+void SessionRecorder::record(const string &line, uint64_t start_ns,
+                             uint64_t duration_ns, int status) {
+  if (fd == -1) return;
+  string rec;
+  // the directory and variables as the command found them
+  string dir = current_dir();
+  if (dir != cwd) {
+    cwd = dir;
+    rec += 'D';
+    put_varint(rec, id);
+    put_string(rec, cwd);
+  }
+  vector<pair<string, string>> now = relevant_env();
+  if (now != env) {
+    env = move(now);
+    rec += 'E';
+    put_varint(rec, id);
+    put_varint(rec, env.size());
+    for (auto &var : env) {
+      put_string(rec, var.first);
+      put_string(rec, var.second);
+    }
+  }
+  rec += 'C';
+  put_varint(rec, id);
+  put_varint(rec, start_ns > last_start_ns ? start_ns - last_start_ns : 0);
+  put_varint(rec, duration_ns);
+  put_varint(rec, status);
+  put_string(rec, line);
+  last_start_ns = max(last_start_ns, start_ns);
+  // one write, so records of shells sharing the file never interleave
+  if (write(fd, rec.data(), rec.size()) != (ssize_t)rec.size()) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+static SessionRecorder *recorder = nullptr;
+
+bool start_recording(const string &path) {
+  delete recorder;
+  recorder = new SessionRecorder(path);
+  if (recorder->ok()) return true;
+  delete recorder;
+  recorder = nullptr;
+  return false;
+}
+
+SessionRecorder *session_recorder() { return recorder; }
+
+/**
+ * @brief Reads the records of a recording; every get fails once the data
+ * runs out.
+ */
+class RecordParser {
+ public:
+  explicit RecordParser(const string &_data) : data(_data), at(0) {}
+
+  bool done() const { return at >= data.size(); }
+
+  bool get_byte(char *c) {
+    if (at >= data.size()) return false;
+    *c = data[at++];
+    return true;
+  }
+
+  bool get_varint(uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (at >= data.size()) return false;
+      uint8_t b = data[at++];
+      *v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool get_string(string *s) {
+    uint64_t len;
+    if (!get_varint(&len) || len > data.size() - at) return false;
+    s->assign(data, at, len);
+    at += len;
+    return true;
+  }
+
+  bool get_magic() {
+    if (data.compare(at, RECORD_MAGIC_LEN, RECORD_MAGIC) != 0) return false;
+    at += RECORD_MAGIC_LEN;
+    return true;
+  }
+
+ private:
+  const string &data;
+  size_t at;
+};
+
+bool read_recording(const string &path, vector<RecordedSession> *sessions) {
+  ifstream in(path, ios::binary);
+  if (!in) return false;
+  string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  RecordParser parser(data);
+  // where each id's session stands; a pid can come back in a later
+  // session, which starts again with an 'S'
+  struct Open {
+    size_t session;
+    uint64_t last_start_ns;
+    string cwd;
+  };
+  map<uint64_t, Open> live;
+  vector<RecordedSession> found;
+  bool any = false;
+  while (!parser.done()) {
+    char tag;
+    uint64_t id;
+    if (!parser.get_byte(&tag) || !parser.get_varint(&id)) break;
+    if (tag == 'S') {
+      RecordedSession session = {id, 0, "", {{}}, {}};
+      if (!parser.get_magic() || !parser.get_varint(&session.start_ns)) {
+        break;
+      }
+      live[id] = {found.size(), session.start_ns, ""};
+      found.push_back(move(session));
+      any = true;
+      continue;
+    }
+    auto it = live.find(id);
+    if (it == live.end()) break;
+    Open &state = it->second;
+    RecordedSession &session = found[state.session];
+    if (tag == 'D') {
+      if (!parser.get_string(&state.cwd)) break;
+      if (session.commands.empty()) session.cwd = state.cwd;
+    } else if (tag == 'E') {
+      uint64_t n;
+      if (!parser.get_varint(&n)) break;
+      vector<pair<string, string>> env(min<uint64_t>(n, data.size()));
+      bool ok = env.size() == n;
+      for (auto &var : env) {
+        ok = ok && parser.get_string(&var.first) &&
+             parser.get_string(&var.second);
+      }
+      if (!ok) break;
+      // the variables a session starts with replace the empty set
+      if (session.commands.empty()) session.envs.clear();
+      session.envs.push_back(move(env));
+    } else if (tag == 'C') {
+      RecordedCommand command;
+      uint64_t delta, status;
+      if (!parser.get_varint(&delta) ||
+          !parser.get_varint(&command.duration_ns) ||
+          !parser.get_varint(&status) || !parser.get_string(&command.line)) {
+        break;
+      }
+      state.last_start_ns += delta;
+      command.start_ns = state.last_start_ns;
+      command.status = status;
+      command.cwd = state.cwd;
+      command.env = session.envs.size() - 1;
+      session.commands.push_back(move(command));
+    } else {
+      break;
+    }
+  }
+  if (!any) return false;
+  stable_sort(found.begin(), found.end(),
+              [](const RecordedSession &a, const RecordedSession &b) {
+                return a.start_ns < b.start_ns;
+              });
+  *sessions = move(found);
+  return true;
+}
@@ -0,0 +1,248 @@
+#include <builtins.h>
+#include <fcntl.h>
+#include <record.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <tsh.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+
+using namespace std;
+
+extern char **environ;
+
+/**
+ * @brief One shell of the replay and the session it replays.
+ */
+struct Replay {
+  const RecordedSession *session;
+  pid_t pid;
+};
+
+/**
+ * @brief The environment the shell of session starts with: ours with the
+ * recorded variables put over it.
+ */
+static vector<string> session_env(const RecordedSession &session) {
+  map<string, string> vars;
+  for (char **e = environ; *e; e++) {
+    const char *eq = strchr(*e, '=');
+    if (eq) vars[string((const char *)*e, eq)] = eq + 1;
+  }
+  for (auto &var : session.envs.front()) vars[var.first] = var.second;
+  vector<string> env;
+  for (auto &var : vars) env.push_back(var.first + "=" + var.second);
+  return env;
+}
+
+/**
+ * @brief Runs r's session in a new shell: starts it at start, then writes
+ * each command line to its stdin at the offset it had in the recording,
+ * divided by speed.
+ */
+static void replay(Replay *r, const string &tsh, const string &out,
+                   chrono::steady_clock::time_point start, double speed) {
+  const RecordedSession &session = *r->session;
+  // everything the child needs is built before the fork
+  vector<string> env = session_env(session);
+  vector<char *> envp;
+  for (string &var : env) envp.push_back((char *)var.c_str());
+  envp.push_back(nullptr);
+  const char *argv[] = {tsh.c_str(), "--record", out.c_str(), nullptr};
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("pipe");
+    return;
+  }
+
+  this_thread::sleep_until(start);
+  r->pid = fork();
+  if (r->pid == 0) {
+    if (!session.cwd.empty() && chdir(session.cwd.c_str()) == -1) {
+      _exit(127);
+    }
+    dup2(fds[0], STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    execve(argv[0], (char **)argv, envp.data());
+    _exit(127);
+  }
+  close(fds[0]);
+  close(null_fd);
+  if (r->pid == -1) {
+    perror("fork");
+    close(fds[1]);
+    return;
+  }
+
+  for (const RecordedCommand &command : session.commands) {
+    chrono::nanoseconds offset(
+        (int64_t)((command.start_ns - session.start_ns) / speed));
+    this_thread::sleep_until(start + offset);
+    // a shell still busy with the last command finds the line when it is
+    // done, like typed-ahead input
+    string line = command.line + "\n";
+    if (write_all(fds[1], line.data(), line.size()) == -1) break;
+  }
+  close(fds[1]);
+  int status;
+  waitpid(r->pid, &status, 0);
+}
+
+static uint64_t percentile(vector<uint64_t> v, double p) {
+  if (v.empty()) return 0;
+  sort(v.begin(), v.end());
+  return v[(size_t)(p * (v.size() - 1))];
+}
+
+/**
+ * @brief Prints the durations of the recorded commands next to those of the
+ * replayed ones, and the commands that slowed down the most.
+ */
+static void report(const vector<Replay> &replays, const string &out) {
+  vector<RecordedSession> replayed;
+  if (!read_recording(out, &replayed)) {
+    fprintf(stderr, "tsh_replay: %s: no commands were replayed\n",
+            out.c_str());
+    return;
+  }
+  map<uint64_t, const RecordedSession *> by_pid;
+  for (const RecordedSession &s : replayed) by_pid[s.id] = &s;
+
+  vector<uint64_t> before, after;
+  // (replayed / recorded, line)
+  vector<pair<double, string>> slower;
+  for (const Replay &r : replays) {
+    auto it = by_pid.find(r.pid);
+    if (it == by_pid.end()) continue;
+    const vector<RecordedCommand> &was = r.session->commands;
+    const vector<RecordedCommand> &now = it->second->commands;
+    for (size_t i = 0; i < was.size() && i < now.size(); i++) {
+      before.push_back(was[i].duration_ns);
+      after.push_back(now[i].duration_ns);
+      slower.push_back({(double)now[i].duration_ns /
+                            max<uint64_t>(was[i].duration_ns, 1),
+                        now[i].line});
+    }
+  }
+  printf("%zu commands in %zu shells\n", after.size(), replays.size());
+  printf("%-10s %12s %12s\n", "", "p50 (us)", "p99 (us)");
+  printf("%-10s %12.1f %12.1f\n", "recorded", percentile(before, 0.5) / 1e3,
+         percentile(before, 0.99) / 1e3);
+  printf("%-10s %12.1f %12.1f\n", "replayed", percentile(after, 0.5) / 1e3,
+         percentile(after, 0.99) / 1e3);
+  sort(slower.begin(), slower.end(),
+       [](const pair<double, string> &a, const pair<double, string> &b) {
+         return a.first > b.first;
+       });
+  for (size_t i = 0; i < slower.size() && i < REPLAY_SLOWEST; i++) {
+    printf("%8.2fx  %s\n", slower[i].first, slower[i].second.c_str());
+  }
+}
+
+/**
+ * @brief tsh_replay: runs recorded sessions (see record.h) again.
+ *
+ * `tsh_replay [--tsh PATH] [--speed N] [--copies K] [--out FILE] FILE...`
+ * starts one tsh_app (--tsh, ./tsh_app by default) for each session of the
+ * recordings, K times over (--copies), in the session's working directory
+ * and with its recorded variables. Each shell starts, and is sent each of
+ * its command lines, at the time it had in the recording counted from the
+ * first session, divided by N (--speed), so sessions overlap and commands
+ * arrive as they did. The shells record themselves into --out (a temporary
+ * file by default), and when all are done the recorded and replayed
+ * durations are compared.
+ *
+ * tsh has no `cd`, so a session keeps the directory it started in.
+ */
+int main(int argc, char **argv) {
+  string tsh = "./tsh_app", out;
+  double speed = 1;
+  int copies = 1;
+  int i = 1;
+  for (; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+    if (strcmp(argv[i], "--tsh") == 0) {
+      tsh = argv[i + 1];
+    } else if (strcmp(argv[i], "--speed") == 0) {
+      speed = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--copies") == 0) {
+      copies = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--out") == 0) {
+      out = argv[i + 1];
+    } else {
+      break;
+    }
+  }
+  if (i == argc || speed <= 0 || copies < 1) {
+    fprintf(stderr,
+            "usage: %s [--tsh PATH] [--speed N] [--copies K] [--out FILE] "
+            "FILE...\n",
+            argv[0]);
+    exit(2);
+  }
+
+  vector<RecordedSession> sessions;
+  for (; i < argc; i++) {
+    vector<RecordedSession> found;
+    if (!read_recording(argv[i], &found)) {
+      fprintf(stderr, "tsh_replay: %s: not a recording\n", argv[i]);
+      exit(2);
+    }
+    move(found.begin(), found.end(), back_inserter(sessions));
+  }
+  sessions.erase(remove_if(sessions.begin(), sessions.end(),
+                           [](const RecordedSession &s) {
+                             return s.commands.empty();
+                           }),
+                 sessions.end());
+  if (sessions.empty()) exit(0);
+  uint64_t first = sessions.front().start_ns;
+  for (const RecordedSession &s : sessions) first = min(first, s.start_ns);
+
+  if (out.empty()) {
+    char path[] = "/tmp/tsh-replay-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+      perror("mkstemp");
+      exit(2);
+    }
+    close(fd);
+    out = path;
+  }
+  // the shells append; only this replay's sessions belong in the report
+  int fd = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    perror(out.c_str());
+    exit(2);
+  }
+  close(fd);
+  // the shells start in other directories
+  char path[PATH_MAX];
+  if (!realpath(tsh.c_str(), path)) {
+    perror(tsh.c_str());
+    exit(2);
+  }
+  tsh = path;
+  realpath(out.c_str(), path);
+  out = path;
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<Replay> replays;
+  for (const RecordedSession &s : sessions) {
+    for (int c = 0; c < copies; c++) replays.push_back({&s, -1});
+  }
+  auto t0 = chrono::steady_clock::now();
+  vector<thread> threads;
+  for (Replay &r : replays) {
+    chrono::nanoseconds offset(
+        (int64_t)((r.session->start_ns - first) / speed));
+    threads.emplace_back(replay, &r, tsh, out, t0 + offset, speed);
+  }
+  for (thread &t : threads) t.join();
+  report(replays, out);
+  exit(0);
+}
@@ -0,0 +1,359 @@
+#include <alias.h>
+#include <fcntl.h>
+#include <libtsh.h>
+#include <poll.h>
+#include <server.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * @brief One command received from a client, with its passed descriptors.
+ */
+struct Request {
+  string line;
+  // stdin, stdout, stderr passed by the client, or -1
+  int fds[3];
+};
+
+/**
+ * @brief Per-client state. Only the epoll thread appends to the queue and
+ * only the worker that owns the session (busy) pops from it.
+ */
+struct Session {
+  int sock;
+  string inbuf;
+  deque<Request> queue;
+  bool busy;
+  bool closed;
+  int last_status;
+  size_t commands;
+  mutex lock;
+};
+
+static mutex ready_lock;
+static condition_variable ready_cond;
+// sessions with queued requests that no worker owns yet
+static deque<shared_ptr<Session>> ready;
+
+static mutex parse_lock;
+static unordered_map<string, shared_ptr<Pipeline>> parse_cache;
+// the definitions_version() the cached parses were made under
+static uint64_t parse_version = 0;
+
+/**
+ * @brief Returns the parsed form of line, parsing it on first use.
+ *
+ * The cache is simply emptied when it reaches SERVE_PARSE_CACHE entries, or
+ * when an alias or function changes; Pipelines still being run stay alive
+ * through their shared_ptr.
+ */
+static shared_ptr<Pipeline> parse_cached(const string &line) {
+  lock_guard<mutex> guard(parse_lock);
+  if (parse_version != definitions_version()) {
+    parse_cache.clear();
+    parse_version = definitions_version();
+  }
+  auto it = parse_cache.find(line);
+  if (it != parse_cache.end()) return it->second;
+  if (parse_cache.size() >= SERVE_PARSE_CACHE) parse_cache.clear();
+  shared_ptr<Pipeline> p = make_shared<Pipeline>(line.c_str());
+  parse_cache[line] = p;
+  return p;
+}
+
+static void close_fds(int fds[3]) {
+  for (int i = 0; i < 3; i++) {
+    if (fds[i] != -1) close(fds[i]);
+  }
+}
+
+/**
+ * @brief Writes all of buf, waiting for the socket when it is full.
+ */
+static bool write_all(int sock, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) {
+      struct pollfd pfd = {sock, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Runs one request and sends its reply.
+ */
+static void handle_request(Session *s, Request &req) {
+  string line = req.line;
+  // the parser works on a single line; drop the Windows-style \r if any
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  string out;
+  int status = 0;
+  if (line.find_first_not_of(" \t") != string::npos) {
+    shared_ptr<Pipeline> p = parse_cached(line);
+    if (req.fds[0] != -1) {
+      status = p->run(req.fds[0], req.fds[1], req.fds[2]);
+    } else {
+      status = p->run("", &out);
+    }
+  }
+  close_fds(req.fds);
+  s->last_status = status;
+  s->commands++;
+
+  string header = to_string(status) + " " + to_string(out.size()) + "\n";
+  write_all(s->sock, header.data(), header.size());
+  write_all(s->sock, out.data(), out.size());
+}
+
+/**
+ * @brief Worker thread: takes a ready session and runs its queued requests
+ * one at a time until the queue is empty.
+ */
+static void worker() {
+  while (true) {
+    shared_ptr<Session> s;
+    {
+      unique_lock<mutex> guard(ready_lock);
+      ready_cond.wait(guard, []() { return !ready.empty(); });
+      s = ready.front();
+      ready.pop_front();
+    }
+    while (true) {
+      Request req;
+      {
+        lock_guard<mutex> guard(s->lock);
+        if (s->queue.empty() || s->closed) {
+          for (Request &r : s->queue) close_fds(r.fds);
+          s->queue.clear();
+          s->busy = false;
+          if (s->closed) close(s->sock);
+          break;
+        }
+        req = s->queue.front();
+        s->queue.pop_front();
+      }
+      handle_request(s.get(), req);
+    }
+  }
+}
+
+/**
+ * @brief Splits the session's input buffer into requests.
+ *
+ * @param fds Descriptors that arrived with the bytes just read; they belong
+ * to the first request completed from those bytes.
+ * @return false if the client sent "quit".
+ */
+static bool queue_requests(Session *s, int fds[3]) {
+  size_t start = 0, nl;
+  bool keep = true;
+  while ((nl = s->inbuf.find('\n', start)) != string::npos) {
+    Request req = {s->inbuf.substr(start, nl - start), {-1, -1, -1}};
+    start = nl + 1;
+    if (fds[0] != -1) {
+      memcpy(req.fds, fds, sizeof(req.fds));
+      fds[0] = fds[1] = fds[2] = -1;
+    }
+    if (req.line.compare(0, 4, "quit") == 0 &&
+        req.line.find_first_not_of(" \t\r", 4) == string::npos) {
+      close_fds(req.fds);
+      keep = false;
+      break;
+    }
+    s->queue.push_back(req);
+  }
+  s->inbuf.erase(0, start);
+  return keep;
+}
+
+/**
+ * @brief Reads everything available from a client.
+ *
+ * @return false when the client hung up or quit.
+ */
+static bool read_client(const shared_ptr<Session> &s) {
+  bool keep = true;
+  while (keep) {
+    char buf[65536];
+    union {
+      char space[CMSG_SPACE(3 * sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    ssize_t n = recvmsg(s->sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) break;
+    if (n <= 0) return false;
+
+    int fds[3] = {-1, -1, -1};
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+      int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int *passed = (int *)CMSG_DATA(c);
+      for (int i = 0; i < count; i++) {
+        if (i < 3) fds[i] = passed[i];
+        else close(passed[i]);
+      }
+    }
+
+    lock_guard<mutex> guard(s->lock);
+    s->inbuf.append(buf, n);
+    keep = queue_requests(s.get(), fds);
+    // descriptors without a complete line to go with them are dropped
+    close_fds(fds);
+    if (!s->queue.empty() && !s->busy) {
+      s->busy = true;
+      lock_guard<mutex> ready_guard(ready_lock);
+      ready.push_back(s);
+      ready_cond.notify_one();
+    }
+  }
+  return keep;
+}
+
+/**
+ * @brief Runs the command server on socket_path until killed.
+ *
+ * One thread multiplexes the listening socket and every client with epoll;
+ * SERVE_WORKERS threads run the commands.
+ *
+ * @return 1 if the socket could not be set up.
+ */
+int serve(const char *socket_path) {
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (listener == -1 || strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "tsh: cannot serve on %s\n", socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+  unlink(socket_path);
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(listener, SOMAXCONN) == -1) {
+    perror("tsh: serve");
+    return 1;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = listener;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+
+  for (int i = 0; i < SERVE_WORKERS; i++) thread(worker).detach();
+
+  map<int, shared_ptr<Session>> sessions;
+  struct epoll_event events[64];
+  while (true) {
+    int n = epoll_wait(epfd, events, 64, -1);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listener) {
+        int client;
+        while ((client = accept4(listener, NULL, NULL,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+          shared_ptr<Session> s = make_shared<Session>();
+          s->sock = client;
+          s->busy = s->closed = false;
+          s->last_status = 0;
+          s->commands = 0;
+          sessions[client] = s;
+          ev.events = EPOLLIN | EPOLLRDHUP;
+          ev.data.fd = client;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, client, &ev);
+        }
+        continue;
+      }
+
+      auto it = sessions.find(fd);
+      if (it == sessions.end()) continue;
+      if (!read_client(it->second)) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        lock_guard<mutex> guard(it->second->lock);
+        // a busy session's socket is closed by its worker when it finishes
+        it->second->closed = true;
+        if (!it->second->busy) close(fd);
+        sessions.erase(it);
+      }
+    }
+  }
+  return 0;
+}
+
+int send_request(int sock, const char *line, const int *fds) {
+  string data = string(line) + "\n";
+  struct iovec iov = {(void *)data.data(), data.size()};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  union {
+    char space[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (fds) {
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, 3 * sizeof(int));
+  }
+  ssize_t n;
+  while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+  }
+  if (n != (ssize_t)data.size()) return -1;
+  return 0;
+}
+
+int read_reply(int sock, string *output) {
+  string header;
+  char c;
+  while (true) {
+    ssize_t n = read(sock, &c, 1);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    if (c == '\n') break;
+    header += c;
+  }
+  int status = 0;
+  size_t len = 0;
+  if (sscanf(header.c_str(), "%d %zu", &status, &len) != 2) return -1;
+  while (len > 0) {
+    char buf[65536];
+    ssize_t n = read(sock, buf, min(len, sizeof(buf)));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    if (output) output->append(buf, n);
+    len -= n;
+  }
+  return status;
+}
@@ -0,0 +1,534 @@
+#include <builtins.h>
+#include <fcntl.h>
+#include <forkless.h>
+#include <sort.h>
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+struct SortOptions {
+  bool unique, numeric, reverse;
+  // field separator, or 0 for runs of blanks
+  char sep;
+  // key fields, 1-based; key_start 0 means the whole line and key_end 0
+  // the end of the line
+  int key_start, key_end;
+  size_t budget;
+};
+
+struct Line {
+  const char *data;
+  uint32_t len;
+  uint32_t key_off;
+  uint32_t key_len;
+  // the first 8 bytes of the key, big-endian, zero padded
+  uint64_t prefix;
+};
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+/**
+ * @brief Offset of the start (end = false) or end of a 1-based field.
+ */
+static size_t field_at(const SortOptions &o, const char *s, size_t n,
+                       int field, bool end) {
+  size_t i = 0;
+  for (int f = 1; f < field + end && i < n; f++) {
+    if (o.sep) {
+      const char *p = (const char *)memchr(s + i, o.sep, n - i);
+      if (!p) return n;
+      // the end of a field is just before its separator
+      if (f == field) return p - s;
+      i = p - s + 1;
+    } else {
+      while (i < n && is_blank(s[i])) i++;
+      while (i < n && !is_blank(s[i])) i++;
+    }
+  }
+  return i;
+}
+
+static Line make_line(const SortOptions &o, const char *s, size_t n) {
+  Line line = {s, (uint32_t)n, 0, (uint32_t)n, 0};
+  if (o.key_start) {
+    size_t start = field_at(o, s, n, o.key_start, false);
+    size_t end = o.key_end ? max(start, field_at(o, s, n, o.key_end, true)) : n;
+    line.key_off = start;
+    line.key_len = end - start;
+  }
+  const unsigned char *key = (const unsigned char *)s + line.key_off;
+  for (size_t i = 0; i < 8; i++) {
+    line.prefix = (line.prefix << 8) | (i < line.key_len ? key[i] : 0);
+  }
+  return line;
+}
+
+/**
+ * @brief Compares the leading numbers of a and b like sort -n: optional
+ * blanks, '-', digits and a fraction; anything else counts as zero.
+ */
+static int compare_numbers(const char *a, size_t alen, const char *b,
+                           size_t blen) {
+  struct Number {
+    bool negative;
+    const char *digits;
+    size_t int_len;
+    const char *frac;
+    size_t frac_len;
+  } num[2];
+  const char *s[2] = {a, b};
+  size_t len[2] = {alen, blen};
+  for (int k = 0; k < 2; k++) {
+    size_t i = 0;
+    while (i < len[k] && is_blank(s[k][i])) i++;
+    num[k].negative = i < len[k] && s[k][i] == '-';
+    if (num[k].negative) i++;
+    while (i < len[k] && s[k][i] == '0') i++;
+    num[k].digits = s[k] + i;
+    while (i < len[k] && isdigit((unsigned char)s[k][i])) i++;
+    num[k].int_len = s[k] + i - num[k].digits;
+    num[k].frac = s[k] + i;
+    num[k].frac_len = 0;
+    if (i < len[k] && s[k][i] == '.') {
+      num[k].frac = s[k] + ++i;
+      while (i < len[k] && isdigit((unsigned char)s[k][i])) i++;
+      num[k].frac_len = s[k] + i - num[k].frac;
+      // trailing zeros of the fraction do not count
+      while (num[k].frac_len && num[k].frac[num[k].frac_len - 1] == '0') {
+        num[k].frac_len--;
+      }
+    }
+    if (!num[k].int_len && !num[k].frac_len) num[k].negative = false;
+  }
+  if (num[0].negative != num[1].negative) return num[0].negative ? -1 : 1;
+  int c = 0;
+  if (num[0].int_len != num[1].int_len) {
+    c = num[0].int_len < num[1].int_len ? -1 : 1;
+  } else {
+    c = memcmp(num[0].digits, num[1].digits, num[0].int_len);
+    if (c == 0) {
+      size_t common = min(num[0].frac_len, num[1].frac_len);
+      c = memcmp(num[0].frac, num[1].frac, common);
+      if (c == 0 && num[0].frac_len != num[1].frac_len) {
+        c = num[0].frac_len < num[1].frac_len ? -1 : 1;
+      }
+    }
+  }
+  return num[0].negative ? -c : c;
+}
+
+static inline int compare_bytes(const char *a, size_t alen, const char *b,
+                                size_t blen) {
+  int c = memcmp(a, b, min(alen, blen));
+  if (c) return c;
+  return alen < blen ? -1 : alen > blen;
+}
+
+/**
+ * @brief Orders lines by key; lines with equal keys are ordered by their
+ * whole text, as a last resort, unless -u makes them duplicates.
+ */
+static int compare_lines(const SortOptions &o, const Line &a, const Line &b) {
+  int c;
+  if (o.numeric) {
+    c = compare_numbers(a.data + a.key_off, a.key_len, b.data + b.key_off,
+                        b.key_len);
+  } else if (a.prefix != b.prefix) {
+    c = a.prefix < b.prefix ? -1 : 1;
+  } else {
+    c = compare_bytes(a.data + a.key_off, a.key_len, b.data + b.key_off,
+                      b.key_len);
+  }
+  if (c == 0 && !o.unique && (o.numeric || o.key_start)) {
+    c = compare_bytes(a.data, a.len, b.data, b.len);
+  }
+  return o.reverse ? -c : c;
+}
+
+/**
+ * @brief Buffered output to a descriptor.
+ */
+class SortWriter {
+ public:
+  explicit SortWriter(int _fd) : fd(_fd), failed(false) {
+    buf.reserve(SORT_IO_BUF);
+  }
+
+  void line(const Line &l) {
+    buf.append(l.data, l.len);
+    buf += '\n';
+    if (buf.size() >= SORT_IO_BUF) flush();
+  }
+
+  bool flush() {
+    if (!failed && write_all(fd, buf.data(), buf.size()) == -1) failed = true;
+    buf.clear();
+    return !failed;
+  }
+
+  int fd;
+  bool failed;
+
+ private:
+  string buf;
+};
+
+/**
+ * @brief Sorted lines, one at a time: a sorted chunk in memory or a run
+ * spilled to a file. A line stays valid until the next call.
+ */
+class SortSource {
+ public:
+  // chunk of records in memory
+  SortSource(const Line *_begin, const Line *_end)
+      : begin(_begin), end(_end), fd(-1) {}
+  // run in a file, read from the start
+  SortSource(int _fd, const SortOptions *_o)
+      : begin(nullptr), end(nullptr), fd(_fd), o(_o), have(0), at(0) {
+    lseek(fd, 0, SEEK_SET);
+    buf.resize(SORT_IO_BUF);
+  }
+  ~SortSource() {
+    if (fd != -1) close(fd);
+  }
+
+  bool next(Line *line) {
+    if (fd == -1) {
+      if (begin == end) return false;
+      *line = *begin++;
+      return true;
+    }
+    while (true) {
+      const char *nl = (const char *)memchr(buf.data() + at, '\n', have - at);
+      if (nl) {
+        *line = make_line(*o, buf.data() + at, nl - buf.data() - at);
+        at = nl - buf.data() + 1;
+        return true;
+      }
+      // move the partial line to the front and read more
+      memmove(buf.data(), buf.data() + at, have - at);
+      have -= at;
+      at = 0;
+      if (have == buf.size()) buf.resize(buf.size() * 2);
+      ssize_t n = read(fd, buf.data() + have, buf.size() - have);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      have += n;
+    }
+  }
+
+ private:
+  const Line *begin, *end;
+  int fd;
+  const SortOptions *o;
+  vector<char> buf;
+  size_t have, at;
+};
+
+/**
+ * @brief Merges the sources into out. Ties go to the earlier source, which
+ * holds the earlier input, so the merge is stable.
+ */
+static void merge(const SortOptions &o, vector<unique_ptr<SortSource>> &sources,
+                  SortWriter &out) {
+  vector<Line> heads(sources.size());
+  auto later = [&](size_t a, size_t b) {
+    int c = compare_lines(o, heads[a], heads[b]);
+    return c != 0 ? c > 0 : a > b;
+  };
+  priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+  for (size_t i = 0; i < sources.size(); i++) {
+    if (sources[i]->next(&heads[i])) heap.push(i);
+  }
+  string last;
+  bool have_last = false;
+  while (!heap.empty() && !out.failed) {
+    size_t i = heap.top();
+    heap.pop();
+    const Line &line = heads[i];
+    bool duplicate = false;
+    if (o.unique) {
+      Line prev = make_line(o, last.data(), last.size());
+      duplicate = have_last && compare_lines(o, prev, line) == 0;
+      if (!duplicate) {
+        last.assign(line.data, line.len);
+        have_last = true;
+      }
+    }
+    if (!duplicate) out.line(line);
+    if (sources[i]->next(&heads[i])) heap.push(i);
+  }
+}
+
+/**
+ * @brief Sorts lines in one chunk per core, in parallel, and returns the
+ * chunks as merge sources.
+ */
+static void sort_chunks(const SortOptions &o, forkless_vector<Line> &lines,
+                        vector<unique_ptr<SortSource>> &sources) {
+  size_t threads = max(1u, thread::hardware_concurrency());
+  threads = max<size_t>(1, min(threads, lines.size() / SORT_MIN_PER_THREAD));
+  size_t per = (lines.size() + threads - 1) / threads;
+  auto less = [&o](const Line &a, const Line &b) {
+    return compare_lines(o, a, b) < 0;
+  };
+  vector<thread> workers;
+  for (size_t start = 0; start < lines.size(); start += per) {
+    Line *begin = lines.data() + start;
+    Line *end = lines.data() + min(lines.size(), start + per);
+    // stable, so that -u keeps the first of equal lines
+    auto work = [begin, end, less]() { stable_sort(begin, end, less); };
+    if (end == lines.data() + lines.size()) {
+      work();
+    } else {
+      workers.emplace_back(work);
+    }
+    sources.emplace_back(new SortSource(begin, end));
+  }
+  for (thread &t : workers) t.join();
+}
+
+/**
+ * @brief Lines read into arena blocks, with the records describing them.
+ * Both are kept out of the children the shell forks meanwhile.
+ */
+struct SortBatch {
+  vector<forkless_block> blocks;
+  forkless_vector<Line> lines;
+  size_t bytes;
+
+  void clear() {
+    blocks.clear();
+    lines.clear();
+    bytes = 0;
+  }
+};
+
+/**
+ * @brief Writes the batch out as a sorted run in an unlinked temporary file.
+ * @return The run's descriptor, or -1.
+ */
+static int spill(const SortOptions &o, SortBatch &batch) {
+  const char *dir = getenv("TMPDIR");
+  string path = string(dir && *dir ? dir : "/tmp") + "/tsh_sort_XXXXXX";
+  int fd = mkostemp(&path[0], O_CLOEXEC);
+  if (fd == -1) return -1;
+  unlink(path.c_str());
+  vector<unique_ptr<SortSource>> chunks;
+  sort_chunks(o, batch.lines, chunks);
+  SortWriter run(fd);
+  merge(o, chunks, run);
+  if (!run.flush()) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Adds an arena block of size bytes to the batch.
+ * @return The block, or null with errno set.
+ */
+static char *new_block(SortBatch &batch, size_t size) {
+  char *block = (char *)forkless_alloc(size);
+  if (!block) return nullptr;
+  batch.blocks.emplace_back(block, ForklessFree{size});
+  batch.bytes += size;
+  return block;
+}
+
+/**
+ * @brief Reads fd into the batch, spilling runs whenever the budget is
+ * exceeded.
+ * @return false on a read or spill error.
+ */
+static bool ingest(const SortOptions &o, int fd, SortBatch &batch,
+                   vector<int> &runs) {
+  char *block = nullptr;
+  size_t cap = 0, fill = 0, start = 0;
+  while (true) {
+    if (fill == cap) {
+      // a new block, taking along the line that did not fit
+      size_t partial = fill - start;
+      size_t size = max((size_t)SORT_ARENA_BLOCK, partial * 2);
+      char *next = new_block(batch, size);
+      if (!next) return false;
+      if (partial) memcpy(next, block + start, partial);
+      block = next;
+      cap = size;
+      fill = partial;
+      start = 0;
+    }
+    ssize_t n = read(fd, block + fill, cap - fill);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    if (n == 0) break;
+    size_t scan = fill;
+    fill += n;
+    const char *nl;
+    while ((nl = (const char *)memchr(block + scan, '\n', fill - scan))) {
+      size_t end = nl - block;
+      batch.lines.push_back(make_line(o, block + start, end - start));
+      start = scan = end + 1;
+    }
+    if (batch.bytes + batch.lines.size() * sizeof(Line) > o.budget &&
+        !batch.lines.empty()) {
+      int run = spill(o, batch);
+      if (run == -1) return false;
+      runs.push_back(run);
+      // keep only the partial line, at the front of a fresh block
+      string partial(block + start, fill - start);
+      batch.clear();
+      size_t size = max((size_t)SORT_ARENA_BLOCK, partial.size() * 2);
+      block = new_block(batch, size);
+      if (!block) return false;
+      memcpy(block, partial.data(), partial.size());
+      cap = size;
+      fill = partial.size();
+      start = 0;
+    }
+  }
+  // a last line without a newline
+  if (fill > start) {
+    batch.lines.push_back(make_line(o, block + start, fill - start));
+  }
+  return true;
+}
+
+/**
+ * @brief Whether the environment asks for byte order, so the builtin sorts
+ * exactly like the real sort would.
+ */
+static bool byte_collation() {
+  const char *vars[] = {"LC_ALL", "LC_COLLATE", "LANG"};
+  for (const char *var : vars) {
+    const char *value = getenv(var);
+    if (!value || !*value) continue;
+    return strcmp(value, "C") == 0 || strcmp(value, "POSIX") == 0 ||
+           strncmp(value, "C.", 2) == 0;
+  }
+  return true;
+}
+
+/**
+ * @brief Parses SIZE for -S: bytes, or with a K, M or G suffix.
+ */
+static bool parse_size(const char *s, size_t *out) {
+  char *end;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (end == s) return false;
+  switch (*end) {
+    case 'G':
+      v <<= 10;
+      [[fallthrough]];
+    case 'M':
+      v <<= 10;
+      [[fallthrough]];
+    case 'K':
+      v <<= 10;
+      end++;
+      break;
+    case 'b':
+      end++;
+      break;
+  }
+  if (*end) return false;
+  *out = v;
+  return true;
+}
+
+int builtin_sort(Process *p, int in_fd, int out_fd, int err_fd) {
+  SortOptions o = {false, false, false, 0, 0, 0, SORT_MEMORY_BUDGET};
+  vector<const char *> files;
+  bool keyed = false;
+  if (!byte_collation()) return run_external(p, in_fd, out_fd, err_fd);
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *tok = p->cmdTokens[i];
+    if (tok[0] != '-' || !tok[1]) {
+      files.push_back(tok);
+      continue;
+    }
+    for (const char *c = tok + 1; *c; c++) {
+      if (*c == 'u') {
+        o.unique = true;
+        continue;
+      }
+      if (*c == 'n') {
+        o.numeric = true;
+        continue;
+      }
+      if (*c == 'r') {
+        o.reverse = true;
+        continue;
+      }
+      if (*c != 't' && *c != 'k' && *c != 'S') {
+        return run_external(p, in_fd, out_fd, err_fd);
+      }
+      const char *value = c[1] ? c + 1 : p->cmdTokens[++i];
+      if (!value) return run_external(p, in_fd, out_fd, err_fd);
+      if (*c == 't') {
+        if (strlen(value) != 1) return run_external(p, in_fd, out_fd, err_fd);
+        o.sep = value[0];
+      } else if (*c == 'S') {
+        if (!parse_size(value, &o.budget)) {
+          return run_external(p, in_fd, out_fd, err_fd);
+        }
+      } else {
+        // only whole fields: N or N,M
+        char *end;
+        long start = strtol(value, &end, 10);
+        long stop = 0;
+        if (*end == ',') stop = strtol(end + 1, &end, 10);
+        if (keyed || *end || start < 1 || stop < 0 || !isdigit(*value)) {
+          return run_external(p, in_fd, out_fd, err_fd);
+        }
+        keyed = true;
+        o.key_start = start;
+        o.key_end = stop;
+      }
+      break;
+    }
+  }
+  if (files.empty()) files.push_back("-");
+
+  SortBatch batch;
+  batch.bytes = 0;
+  vector<int> runs;
+  int status = 0;
+  for (const char *file : files) {
+    int fd = in_fd;
+    if (strcmp(file, "-") != 0) {
+      fd = open(file, O_RDONLY | O_CLOEXEC);
+      if (fd == -1) {
+        dprintf(err_fd, "tsh: sort: %s: %s\n", file, strerror(errno));
+        status = 2;
+        break;
+      }
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    bool ok = ingest(o, fd, batch, runs);
+    if (!ok) dprintf(err_fd, "tsh: sort: %s: %s\n", file, strerror(errno));
+    if (fd != in_fd) close(fd);
+    if (!ok) {
+      status = 2;
+      break;
+    }
+  }
+
+  if (status == 0) {
+    vector<unique_ptr<SortSource>> sources;
+    for (int run : runs) sources.emplace_back(new SortSource(run, &o));
+    runs.clear();
+    sort_chunks(o, batch.lines, sources);
+    SortWriter out(out_fd);
+    merge(o, sources, out);
+    if (!out.flush()) status = write_error_status(errno);
+  }
+  for (int run : runs) close(run);
+  return status;
+}
@@ -0,0 +1,119 @@
+#include <alias.h>
+#include <fcntl.h>
+#include <pathcache.h>
+#include <speculate.h>
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+// never destroyed: the worker is detached and still waits on them at exit
+static mutex &spec_lock = *new mutex;
+static condition_variable &spec_cond = *new condition_variable;
+// line waiting for the worker, and whether one is waiting
+static string wanted_line;
+static bool wanted = false;
+// line the worker is preparing right now
+static string working_line;
+static bool working = false;
+// the last prepared line, its parse and the definitions_version() it was
+// parsed under
+static string ready_line;
+static list<Process *> ready_list;
+static uint64_t ready_version = 0;
+static bool worker_started = false;
+
+/**
+ * @brief Pulls a file into the page cache, once per path and mtime.
+ */
+static void prefetch(const string &path) {
+  static set<pair<string, long>> done;
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) return;
+  if (!done.insert({path, (long)st.st_mtime}).second) return;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return;
+  posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+  readahead(fd, 0, st.st_size);
+  close(fd);
+}
+
+/**
+ * @brief Parses line and prefetches what running it would read.
+ */
+static void prepare(const string &line, list<Process *> &process_list) {
+  parse_input((char *)line.c_str(), process_list);
+  for (Process *p : process_list) {
+    if (!p->cmdTokens[0]) continue;
+    string path = strchr(p->cmdTokens[0], '/') ? p->cmdTokens[0]
+                                               : path_lookup(p->cmdTokens[0]);
+    if (!path.empty()) prefetch(path);
+    for (int i = 0; p->cmdTokens[i]; i++) {
+      const char *tok = p->cmdTokens[i];
+      if (strcmp(tok, "<") == 0 && p->cmdTokens[i + 1]) {
+        prefetch(p->cmdTokens[i + 1]);
+      } else if (tok[0] == '<' && tok[1]) {
+        prefetch(tok + 1);
+      }
+    }
+  }
+}
+
+static void worker() {
+  while (true) {
+    string line;
+    {
+      unique_lock<mutex> guard(spec_lock);
+      spec_cond.wait(guard, []() { return wanted; });
+      line.swap(wanted_line);
+      wanted = false;
+      working_line = line;
+      working = true;
+    }
+    list<Process *> process_list;
+    uint64_t version = definitions_version();
+    prepare(line, process_list);
+
+    lock_guard<mutex> guard(spec_lock);
+    cleanup(ready_list, nullptr);
+    ready_list.swap(process_list);
+    ready_line = line;
+    ready_version = version;
+    working = false;
+    spec_cond.notify_all();
+  }
+}
+
+void speculate(const char *partial_line) {
+  lock_guard<mutex> guard(spec_lock);
+  if ((working && working_line == partial_line) || ready_line == partial_line) {
+    return;
+  }
+  wanted_line = partial_line;
+  wanted = true;
+  if (!worker_started) {
+    worker_started = true;
+    thread(worker).detach();
+  }
+  spec_cond.notify_all();
+}
+
+bool take_speculation(const char *line, list<Process *> &process_list) {
+  unique_lock<mutex> guard(spec_lock);
+  spec_cond.wait(guard, [line]() {
+    return !(working && working_line == line) &&
+           !(wanted && wanted_line == line);
+  });
+  // an alias or function defined since may change the parse
+  if (ready_list.empty() || ready_line != line ||
+      ready_version != definitions_version()) {
+    return false;
+  }
+  process_list.splice(process_list.end(), ready_list);
+  ready_line.clear();
+  return true;
+}
@@ -0,0 +1,468 @@
+#include <builtins.h>
+#include <fcntl.h>
+#include <fileutils.h>
+#include <sys/stat.h>
+#include <textutils.h>
+
+#include <deque>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static size_t count_scalar(const char *buf, size_t n, char c) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) count += buf[i] == c;
+  return count;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Each comparison yields 0xff (-1) per matching byte; subtracting it
+ * adds one to that byte's counter, and the counters are folded into the
+ * total with sad_epu8 before any of them can overflow.
+ */
+__attribute__((target("avx2"))) static size_t count_avx2(const char *buf,
+                                                          size_t n, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t count = 0, i = 0;
+  while (i + 32 <= n) {
+    __m256i acc = zero;
+    size_t stop = min(n - 31, i + 255 * 32);
+    for (; i < stop; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+    }
+    __m256i sums = _mm256_sad_epu8(acc, zero);
+    count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+             _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+  }
+  return count + count_scalar(buf + i, n - i, c);
+}
+
+static size_t count_sse2(const char *buf, size_t n, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  const __m128i zero = _mm_setzero_si128();
+  size_t count = 0, i = 0;
+  while (i + 16 <= n) {
+    __m128i acc = zero;
+    size_t stop = min(n - 15, i + 255 * 16);
+    for (; i < stop; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+    }
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    count += _mm_cvtsi128_si64(sums) +
+             _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+  }
+  return count + count_scalar(buf + i, n - i, c);
+}
+#endif
+
+size_t count_byte(const char *buf, size_t n, char c) {
+#if defined(__x86_64__)
+  static size_t (*const impl)(const char *, size_t, char) =
+      __builtin_cpu_supports("avx2") ? count_avx2 : count_sse2;
+  return impl(buf, n, c);
+#else
+  return count_scalar(buf, n, c);
+#endif
+}
+
+/**
+ * @brief Parses a count made of digits only.
+ * @return false for anything else (signs, suffixes), which the real program
+ * may still understand.
+ */
+static bool parse_count(const char *s, long *out) {
+  if (!*s) return false;
+  for (const char *c = s; *c; c++) {
+    if (!isdigit((unsigned char)*c)) return false;
+  }
+  *out = strtol(s, NULL, 10);
+  return true;
+}
+
+/**
+ * @brief Parses the options shared by head and tail.
+ *
+ * @param lines Set by -n N and -N. @param bytes Set by -c N.
+ * @param file Set to the single file operand, if any.
+ * @return false if the command uses anything else, e.g. several files.
+ */
+static bool parse_head_tail(Process *p, long *lines, long *bytes,
+                            const char **file) {
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *tok = p->cmdTokens[i];
+    const char *value = NULL;
+    bool by_bytes = false;
+    if (tok[0] != '-' || !tok[1]) {
+      if (*file) return false;
+      *file = tok;
+      continue;
+    }
+    if (tok[1] == 'n' || tok[1] == 'c') {
+      by_bytes = tok[1] == 'c';
+      value = tok[2] ? tok + 2 : p->cmdTokens[++i];
+      if (!value) return false;
+    } else if (isdigit((unsigned char)tok[1])) {
+      value = tok + 1;
+    } else {
+      return false;
+    }
+    long count;
+    if (!parse_count(value, &count)) return false;
+    *lines = by_bytes ? -1 : count;
+    *bytes = by_bytes ? count : -1;
+  }
+  return true;
+}
+
+/**
+ * @brief Opens file for a builtin, or returns in_fd when there is none.
+ * @return The descriptor, or -1 after reporting the error.
+ */
+static int open_input(const char *name, const char *file, int in_fd,
+                      int err_fd) {
+  if (!file || strcmp(file, "-") == 0) return in_fd;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    dprintf(err_fd, "tsh: %s: %s: %s\n", name, file, strerror(errno));
+  }
+  return fd;
+}
+
+struct Counts {
+  size_t lines, words, bytes;
+};
+
+/**
+ * @brief Counts fd for wc. Bytes alone come from the size of a regular file
+ * without reading it.
+ * @return false on a read error.
+ */
+static bool count_fd(int fd, bool need_read, bool need_words, Counts *counts,
+                     bool *regular) {
+  *counts = {0, 0, 0};
+  struct stat st;
+  *regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  if (!need_read && *regular) {
+    off_t at = lseek(fd, 0, SEEK_CUR);
+    counts->bytes = st.st_size > at && at >= 0 ? st.st_size - at : 0;
+    return true;
+  }
+  if (*regular) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  vector<char> buf(TEXT_BUF_SIZE);
+  bool in_word = false;
+  while (true) {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    if (n == 0) return true;
+    counts->bytes += n;
+    counts->lines += count_byte(buf.data(), n, '\n');
+    if (!need_words) continue;
+    for (ssize_t i = 0; i < n; i++) {
+      bool space = isspace((unsigned char)buf[i]);
+      if (!space && !in_word) counts->words++;
+      in_word = !space;
+    }
+  }
+}
+
+int builtin_echo(Process *p, int in_fd, int out_fd, int err_fd) {
+  int i = 1;
+  bool newline = true;
+  const char *first = p->cmdTokens[1];
+  if (first && (strcmp(first, "-e") == 0 || strcmp(first, "-E") == 0)) {
+    return run_external(p, in_fd, out_fd, err_fd);
+  }
+  if (first && strcmp(first, "-n") == 0) {
+    newline = false;
+    i++;
+  }
+  string out;
+  for (int start = i; p->cmdTokens[i]; i++) {
+    if (i > start) out += ' ';
+    out += p->cmdTokens[i];
+  }
+  if (newline) out += '\n';
+  if (write_all(out_fd, out.data(), out.size()) == -1) {
+    return write_error_status(errno);
+  }
+  return 0;
+}
+
+int builtin_wc(Process *p, int in_fd, int out_fd, int err_fd) {
+  bool lines = false, words = false, bytes = false;
+  vector<const char *> files;
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *tok = p->cmdTokens[i];
+    if (tok[0] != '-' || !tok[1]) {
+      files.push_back(tok);
+      continue;
+    }
+    for (const char *c = tok + 1; *c; c++) {
+      if (*c == 'l') {
+        lines = true;
+      } else if (*c == 'w') {
+        words = true;
+      } else if (*c == 'c') {
+        bytes = true;
+      } else {
+        return run_external(p, in_fd, out_fd, err_fd);
+      }
+    }
+  }
+  if (!lines && !words && !bytes) lines = words = bytes = true;
+  bool stdin_only = files.empty();
+  if (stdin_only) files.push_back(NULL);
+
+  // columns are as wide as the total size needs, like GNU wc, or 7 when
+  // the size of some input is unknown
+  int fields = lines + words + bytes;
+  int width = 1;
+  if (fields > 1 || files.size() > 1) {
+    size_t total_size = 0;
+    bool unknown = false;
+    for (const char *file : files) {
+      struct stat st;
+      if (file && strcmp(file, "-") != 0 && stat(file, &st) == 0 &&
+          S_ISREG(st.st_mode)) {
+        total_size += st.st_size;
+      } else {
+        unknown = true;
+      }
+    }
+    width = unknown ? 7 : max(1, (int)to_string(total_size).size());
+  }
+
+  int status = 0;
+  Counts total = {0, 0, 0};
+  string out;
+  auto print = [&](const Counts &c, const char *name) {
+    char field[32];
+    const char *sep = "";
+    if (lines) {
+      snprintf(field, sizeof(field), "%*zu", width, c.lines);
+      out += field;
+      sep = " ";
+    }
+    if (words) {
+      snprintf(field, sizeof(field), "%s%*zu", sep, width, c.words);
+      out += field;
+      sep = " ";
+    }
+    if (bytes) {
+      snprintf(field, sizeof(field), "%s%*zu", sep, width, c.bytes);
+      out += field;
+    }
+    if (name) {
+      out += ' ';
+      out += name;
+    }
+    out += '\n';
+  };
+  for (const char *file : files) {
+    int fd = open_input("wc", file, in_fd, err_fd);
+    if (fd == -1) {
+      status = 1;
+      continue;
+    }
+    Counts counts;
+    bool regular;
+    bool ok = count_fd(fd, lines || words, words, &counts, &regular);
+    if (!ok) {
+      dprintf(err_fd, "tsh: wc: %s: %s\n", file ? file : "-", strerror(errno));
+      status = 1;
+    }
+    if (fd != in_fd) close(fd);
+    if (!ok) continue;
+    total.lines += counts.lines;
+    total.words += counts.words;
+    total.bytes += counts.bytes;
+    print(counts, stdin_only ? NULL : file);
+  }
+  if (files.size() > 1) print(total, "total");
+  if (write_all(out_fd, out.data(), out.size()) == -1) {
+    return write_error_status(errno);
+  }
+  return status;
+}
+
+int builtin_head(Process *p, int in_fd, int out_fd, int err_fd) {
+  long lines = 10, bytes = -1;
+  const char *file = NULL;
+  if (!parse_head_tail(p, &lines, &bytes, &file)) {
+    return run_external(p, in_fd, out_fd, err_fd);
+  }
+  int fd = open_input("head", file, in_fd, err_fd);
+  if (fd == -1) return 1;
+
+  bool by_bytes = bytes >= 0;
+  size_t left = by_bytes ? bytes : lines;
+  vector<char> buf(HEAD_BUF_SIZE);
+  int status = 0;
+  while (left > 0) {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      dprintf(err_fd, "tsh: head: %s\n", strerror(errno));
+      status = 1;
+    }
+    if (n <= 0) break;
+    size_t take = n;
+    if (by_bytes) {
+      take = min(take, left);
+      left -= take;
+    } else {
+      size_t found = count_byte(buf.data(), n, '\n');
+      if (found < left) {
+        left -= found;
+      } else {
+        const char *at = buf.data();
+        for (; left > 0; left--) {
+          at = (const char *)memchr(at, '\n', buf.data() + n - at) + 1;
+        }
+        take = at - buf.data();
+      }
+    }
+    if (write_all(out_fd, buf.data(), take) == -1) {
+      status = write_error_status(errno);
+      break;
+    }
+    // leave the rest of a seekable input to whoever reads it next
+    if (left == 0 && take < (size_t)n) lseek(fd, take - n, SEEK_CUR);
+  }
+  if (fd != in_fd) close(fd);
+  return status;
+}
+
+/**
+ * @brief Offset in buf[0, n) where its last `lines` lines start; a final
+ * newline does not start another line.
+ * @return The offset, or -1 if buf holds fewer lines.
+ */
+static ssize_t tail_start(const char *buf, size_t n, size_t lines) {
+  if (lines == 0) return n;
+  size_t end = n && buf[n - 1] == '\n' ? n - 1 : n;
+  for (size_t seen = 0; end > 0;) {
+    const char *nl = (const char *)memrchr(buf, '\n', end);
+    if (!nl) break;
+    if (++seen == lines) return nl - buf + 1;
+    end = nl - buf;
+  }
+  return -1;
+}
+
+/**
+ * @brief tail of a regular file: scans backwards from the end, counting
+ * newlines a block at a time, then copies from the start of the tail.
+ */
+static int tail_file(int fd, off_t size, long lines, long bytes, int out_fd) {
+  off_t begin = lseek(fd, 0, SEEK_CUR);
+  off_t from = begin;
+  if (bytes >= 0) {
+    from = max(begin, size - (off_t)bytes);
+  } else if (lines == 0) {
+    from = size;
+  } else {
+    vector<char> buf(TAIL_BLOCK_SIZE);
+    size_t need = lines;
+    off_t end = size;
+    bool last_block = true;
+    while (end > begin) {
+      size_t len = min((off_t)buf.size(), end - begin);
+      off_t at = end - len;
+      if (pread(fd, buf.data(), len, at) != (ssize_t)len) return -1;
+      // a newline ending the file does not start another line
+      size_t scan = len;
+      if (last_block && buf[len - 1] == '\n') scan--;
+      last_block = false;
+      size_t found = count_byte(buf.data(), scan, '\n');
+      if (found >= need) {
+        const char *nl = buf.data() + scan;
+        for (; need > 0; need--) {
+          nl = (const char *)memrchr(buf.data(), '\n', nl - buf.data());
+        }
+        from = at + (nl - buf.data()) + 1;
+        break;
+      }
+      need -= found;
+      end = at;
+    }
+  }
+  if (lseek(fd, from, SEEK_SET) == -1) return -1;
+  return copy_fd(fd, out_fd);
+}
+
+/**
+ * @brief tail of a stream: keeps only the newest blocks that can hold the
+ * tail while reading, then finds where it starts.
+ */
+static int tail_stream(int fd, long lines, long bytes, int out_fd) {
+  deque<string> blocks;
+  deque<size_t> newlines;
+  size_t held = 0, held_newlines = 0;
+  vector<char> buf(TEXT_BUF_SIZE);
+  while (true) {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) break;
+    size_t found = bytes >= 0 ? 0 : count_byte(buf.data(), n, '\n');
+    blocks.emplace_back(buf.data(), n);
+    newlines.push_back(found);
+    held += n;
+    held_newlines += found;
+    // the oldest block can go once the rest alone is enough; one newline
+    // more than needed covers a newline that ends the input
+    while (blocks.size() > 1 &&
+           (bytes >= 0 ? held - blocks.front().size() >= (size_t)bytes
+                       : held_newlines - newlines.front() > (size_t)lines)) {
+      held -= blocks.front().size();
+      held_newlines -= newlines.front();
+      blocks.pop_front();
+      newlines.pop_front();
+    }
+  }
+  string data;
+  data.reserve(held);
+  for (const string &block : blocks) data += block;
+  size_t from = 0;
+  if (bytes >= 0) {
+    from = data.size() > (size_t)bytes ? data.size() - bytes : 0;
+  } else {
+    ssize_t start = tail_start(data.data(), data.size(), lines);
+    from = start < 0 ? 0 : start;
+  }
+  return write_all(out_fd, data.data() + from, data.size() - from);
+}
+
+int builtin_tail(Process *p, int in_fd, int out_fd, int err_fd) {
+  long lines = 10, bytes = -1;
+  const char *file = NULL;
+  if (!parse_head_tail(p, &lines, &bytes, &file)) {
+    return run_external(p, in_fd, out_fd, err_fd);
+  }
+  int fd = open_input("tail", file, in_fd, err_fd);
+  if (fd == -1) return 1;
+
+  struct stat st;
+  int result;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    result = tail_file(fd, st.st_size, lines, bytes, out_fd);
+  } else {
+    result = tail_stream(fd, lines, bytes, out_fd);
+  }
+  int err = errno;
+  if (fd != in_fd) close(fd);
+  if (result == 0) return 0;
+  if (err == EPIPE) return write_error_status(err);
+  dprintf(err_fd, "tsh: tail: %s\n", strerror(err));
+  return 1;
+}
@@ -0,0 +1,154 @@
+#include <sched.h>
+#include <topology.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+using namespace std;
+
+vector<int> parse_cpu_list(const string &text) {
+  vector<int> cpus;
+  size_t i = 0;
+  while (i < text.size()) {
+    char *end;
+    long first = strtol(text.c_str() + i, &end, 10);
+    if (end == text.c_str() + i) break;
+    long last = first;
+    if (*end == '-') {
+      const char *from = end + 1;
+      last = strtol(from, &end, 10);
+      if (end == from) break;
+    }
+    for (long cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    i = end - text.c_str();
+    if (text[i] != ',') break;
+    i++;
+  }
+  return cpus;
+}
+
+static string read_line_of(const string &path) {
+  ifstream in(path);
+  string line;
+  getline(in, line);
+  return line;
+}
+
+vector<CpuInfo> read_cpu_topology(const string &root) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return {};
+
+  map<int, int> node_of;
+  for (int node = 0;; node++) {
+    string list =
+        read_line_of(root + "/node/node" + to_string(node) + "/cpulist");
+    if (list.empty()) break;
+    for (int cpu : parse_cpu_list(list)) node_of[cpu] = node;
+  }
+
+  vector<CpuInfo> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    auto node = node_of.find(cpu);
+    CpuInfo info = {cpu, node == node_of.end() ? 0 : node->second, -1, cpu};
+    string cache = root + "/cpu/cpu" + to_string(cpu) + "/cache/index";
+    for (int index = 0;; index++) {
+      string dir = cache + to_string(index);
+      string level = read_line_of(dir + "/level");
+      if (level.empty()) break;
+      if (read_line_of(dir + "/type") == "Instruction") continue;
+      vector<int> shared =
+          parse_cpu_list(read_line_of(dir + "/shared_cpu_list"));
+      int id = shared.empty() ? cpu : *min_element(shared.begin(),
+                                                   shared.end());
+      if (level == "2") info.l2 = id;
+      if (level == "3") info.l3 = id;
+    }
+    // a node-sized domain when the L3 is unknown
+    if (info.l3 == -1) info.l3 = -1 - info.node;
+    cpus.push_back(info);
+  }
+  return cpus;
+}
+
+CpuPlacer::CpuPlacer(vector<CpuInfo> _cpus)
+    : cpus(move(_cpus)), next_domain(0) {
+  sort(cpus.begin(), cpus.end(), [](const CpuInfo &a, const CpuInfo &b) {
+    if (a.node != b.node) return a.node < b.node;
+    if (a.l3 != b.l3) return a.l3 < b.l3;
+    if (a.l2 != b.l2) return a.l2 < b.l2;
+    return a.cpu < b.cpu;
+  });
+  // the domains of each node, in order
+  map<int, vector<Domain>> by_node;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t end = i;
+    while (end < cpus.size() && cpus[end].node == cpus[i].node &&
+           cpus[end].l3 == cpus[i].l3) {
+      end++;
+    }
+    by_node[cpus[i].node].push_back({i, end, i});
+    i = end;
+  }
+  // alternate between the nodes
+  for (size_t k = 0;; k++) {
+    bool any = false;
+    for (auto &node : by_node) {
+      if (k < node.second.size()) {
+        domains.push_back(node.second[k]);
+        any = true;
+      }
+    }
+    if (!any) break;
+  }
+  domain_of.resize(cpus.size());
+  for (size_t d = 0; d < domains.size(); d++) {
+    for (size_t i = domains[d].begin; i < domains[d].end; i++) {
+      domain_of[i] = d;
+    }
+  }
+}
+
+int CpuPlacer::first_stage() {
+  lock_guard<mutex> guard(lock);
+  if (domains.empty()) return -1;
+  Domain &domain = domains[next_domain];
+  next_domain = (next_domain + 1) % domains.size();
+  size_t at = domain.next;
+  // the next pipeline here starts on the cpu after this one
+  domain.next = at + 1 == domain.end ? domain.begin : at + 1;
+  return cpus[at].cpu;
+}
+
+int CpuPlacer::next_stage(int cpu) {
+  lock_guard<mutex> guard(lock);
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (cpus[i].cpu != cpu) continue;
+    const Domain &domain = domains[domain_of[i]];
+    return cpus[i + 1 == domain.end ? domain.begin : i + 1].cpu;
+  }
+  return -1;
+}
+
+// the cpu of the last stage placed by this thread
+static thread_local int last_cpu = -1;
+
+int place_stage(bool first) {
+  const char *mode = getenv("TSH_AFFINITY");
+  if (!mode || strcmp(mode, "cache") != 0) return -1;
+  // never destroyed: builtin threads may still be launching at exit
+  static CpuPlacer &placer = *new CpuPlacer(read_cpu_topology());
+  last_cpu = first || last_cpu == -1 ? placer.first_stage()
+                                     : placer.next_stage(last_cpu);
+  return last_cpu;
+}
+
+void pin_to_cpu(int cpu) {
+  if (cpu < 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
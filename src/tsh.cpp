@@ -1,4 +1,18 @@
+#include <alias.h>
+#include <builtins.h>
+#include <editor.h>
+#include <forkless.h>
+#include <history.h>
+#include <launcher.h>
+#include <prompt.h>
+#include <qos.h>
+#include <record.h>
+#include <speculate.h>
 #include <tsh.h>
+#include <variables.h>
+
+#include <chrono>
+#include <set>
 
 using namespace std;
 
@@ -12,8 +26,18 @@ using namespace std;
  * which is displayed before each command. PS2 is the secondary prompt displayed
  * when a command needs more input (e.g. a multi-line command). PS3 is not very
  * commonly used
+ *
+ * The prompt is only printed when stdin is a terminal, so tsh can be driven
+ * non-interactively (e.g. `tsh_app < script`) without prompts in its output.
+ * Its format comes from $TSH_PS1; see prompt.h for the supported segments.
+ * When the line editor is in use it draws the prompt itself.
  */
-void display_prompt() {cout << "$ ";}
+void display_prompt() {
+  if (!isatty(STDIN_FILENO) || shell_editor()) return;
+  string prompt = render_prompt(prompt_format());
+  cout << prompt << flush;
+  prompt_drawn(prompt);
+}
 
 /**
  * @brief Cleans up allocated resources to prevent memory leaks.
@@ -34,6 +58,23 @@ void cleanup(list<Process *> &process_list, char *input_line) {
   input_line = nullptr;
 }
 
+/**
+ * @brief Appends a command line that ran to the session recording, if there
+ * is one (see record.h); blank lines are left out.
+ */
+static void record_line(const string &line,
+                        chrono::system_clock::time_point wall_start,
+                        chrono::steady_clock::duration took, int status) {
+  SessionRecorder *recorder = session_recorder();
+  if (!recorder || !line[strspn(line.c_str(), " \t")]) return;
+  recorder->record(line,
+                   chrono::duration_cast<chrono::nanoseconds>(
+                       wall_start.time_since_epoch())
+                       .count(),
+                   chrono::duration_cast<chrono::nanoseconds>(took).count(),
+                   status);
+}
+
 /**
  * @brief Main loop for the shell, facilitating user interaction and command
  * execution.
@@ -47,8 +88,9 @@ void cleanup(list<Process *> &process_list, char *input_line) {
  *   2. Reading user input using the read_input function.
  *   3. Parsing the input into a list of Process objects using parse_input.
  *   4. Executing the commands using run_commands.
- *   5. Cleaning up allocated resources to prevent memory leaks with the cleanup
- * function.
+ *   5. Recording the command if the session is recorded (see record.h), then
+ * cleaning up allocated resources to prevent memory leaks with the cleanup
+ * function and trimming the heap (see trim_heap()).
  *   6. Breaking out of the loop if the user enters the quit command.
  *   7. Continuously prompting the user for new commands until an exit condition
  * is met.
@@ -71,18 +113,59 @@ void cleanup(list<Process *> &process_list, char *input_line) {
  * user.
  */
 void run() {
+  static PosixLauncher launcher;
   list<Process *> process_list;
   char *input_line;
   bool is_quit = false;
+  int status = 0;
   while (!is_quit){
     display_prompt();
-    char* input = read_input();
-    parse_input(input, process_list);
-    is_quit = run_commands(process_list);
+    input_line = read_input();
+    prompt_done();
+    // EOF on stdin ends the session like quit
+    if (input_line == NULL) break;
+    History *history = shell_history();
+    if (history && input_line[strspn(input_line, " \t")]) {
+      history->add(input_line);
+    }
+    // parsing cuts the line up
+    string line = session_recorder() ? input_line : "";
+    // the line editor may already have parsed this line while it was typed
+    if (!take_speculation(input_line, process_list)) {
+      parse_input(input_line, process_list);
+    }
+    auto start = chrono::steady_clock::now();
+    auto wall_start = chrono::system_clock::now();
+    is_quit = run_commands(process_list, launcher, -1, -1, -1, &status);
+    auto took = chrono::steady_clock::now() - start;
+    prompt_command_done(
+        status, chrono::duration_cast<chrono::milliseconds>(took).count());
+    record_line(line, wall_start, took, status);
     cleanup(process_list, input_line);
+    // what the command freed should not be copied by the next fork
+    trim_heap();
   }
 }
 
+/**
+ * @brief Runs one command line, as `tsh_app -c LINE` does.
+ *
+ * @return The exit code of the last pipeline that ran (see run_commands()).
+ */
+int run_line(const char *line) {
+  static PosixLauncher launcher;
+  list<Process *> process_list;
+  char *input_line = strdup(line);
+  parse_input(input_line, process_list);
+  int status = 0;
+  auto start = chrono::steady_clock::now();
+  auto wall_start = chrono::system_clock::now();
+  run_commands(process_list, launcher, -1, -1, -1, &status);
+  record_line(line, wall_start, chrono::steady_clock::now() - start, status);
+  cleanup(process_list, input_line);
+  return status;
+}
+
 /**
  * @brief Reads input from the standard input (stdin) in chunks and dynamically
  *        allocates memory to store the entire input.
@@ -98,73 +181,231 @@ void run() {
  * longer needed. If an error occurs or EOF is reached during input, the
  * function returns NULL.
  *
+ * On a terminal the line is read with the line editor instead (see
+ * editor.h), which also draws the prompt.
+ *
  * @warning Ensure that the memory allocated by this function is freed using
  * free() to avoid memory leaks.
  */
 char *read_input() {
+  if (LineEditor *editor = shell_editor()) {
+    string prompt = render_prompt(prompt_format());
+    prompt_drawn(prompt);
+    string line;
+    if (!editor->read_line(prompt, &line)) return NULL;
+    return strdup(line.c_str());
+  }
   char *input = NULL;
   char tempbuf[MAX_LINE];
-  //size_t inputlen = 0, templen = 0;
-  std::cout << "Enter a line: ";
-  std::cin.getline(tempbuf, MAX_LINE);
-  input = strdup(tempbuf);
+  size_t inputlen = 0, templen = 0, inputcap = 0;
+  while (true) {
+    cin.getline(tempbuf, MAX_LINE);
+    templen = strlen(tempbuf);
+    if (inputlen + templen + 1 > inputcap) {
+      // grow geometrically so long lines are not copied once per chunk
+      inputcap = max(inputcap * 2, inputlen + templen + 1);
+      input = (char *)realloc(input, inputcap);
+    }
+    memcpy(input + inputlen, tempbuf, templen + 1);
+    inputlen += templen;
+    if (cin.eof()) {
+      // EOF with nothing read means there is no more input
+      if (inputlen == 0) {
+        free(input);
+        return NULL;
+      }
+      cin.clear();
+      break;
+    }
+    if (cin.fail()) {
+      // the chunk filled up before the newline; keep reading
+      cin.clear();
+      continue;
+    }
+    break;
+  }
   return input;
 }
 
+/**
+ * @brief Whether s starts with word followed by a blank, ';' or its end.
+ */
+static bool is_word(const char *s, const char *word) {
+  size_t len = strlen(word);
+  return strncmp(s, word, len) == 0 && strchr(" \t\n;|", s[len]);
+}
+
+/**
+ * @brief Compiles `while COND; do BODY; done` at text into one Process.
+ *
+ * The loop's command is COND, and BODY is parsed into its body. Nested
+ * loops are matched by counting the words `do` and `done`.
+ *
+ * @return The text after `done`, or null (leaving loop unset) if the loop
+ * is incomplete.
+ */
+static char *parse_while(char *text, Process **loop, set<string> &expanding) {
+  char *cond_end = strchr(text, ';');
+  if (!cond_end) return NULL;
+  char *body = cond_end + 1 + strspn(cond_end + 1, " \t\n");
+  if (!is_word(body, "do")) return NULL;
+  body += 2;
+  int depth = 1;
+  for (char *w = body; *w;) {
+    w += strspn(w, " \t\n;|");
+    size_t len = strcspn(w, " \t\n;|");
+    if (len == 2 && strncmp(w, "do", 2) == 0) depth++;
+    if (len == 4 && strncmp(w, "done", 4) == 0 && --depth == 0) {
+      *cond_end = '\0';
+      *w = '\0';
+      *loop = new Process(text, 0, 0);
+      parse_input(body, (*loop)->body, expanding);
+      return w + len;
+    }
+    w += len;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Compiles a function definition at text, `NAME() { BODY; }` or
+ * `function NAME { BODY; }`, into a `function NAME` command holding BODY
+ * (see builtin_function()). Braces in BODY nest.
+ *
+ * @return The text after the closing '}', or null (leaving def unset) if
+ * text is not a complete definition.
+ */
+static char *parse_function(char *text, Process **def) {
+  const char *name_end = " \t\n;|(){}";
+  char *s = text;
+  bool keyword = is_word(s, "function");
+  if (keyword) s += strlen("function") + strspn(s + strlen("function"), " \t");
+  string name(s, strcspn(s, name_end));
+  if (name.empty()) return NULL;
+  s += name.size() + strspn(s + name.size(), " \t");
+  if (strncmp(s, "()", 2) == 0) {
+    s += 2;
+  } else if (!keyword) {
+    return NULL;
+  }
+  s += strspn(s, " \t\n");
+  if (*s != '{' || !strchr(" \t\n", s[1])) return NULL;
+  char *body = s + 1;
+  int depth = 1;
+  for (char *w = body; *w;) {
+    w += strspn(w, " \t\n;|");
+    size_t len = strcspn(w, " \t\n;|");
+    if (len == 1 && *w == '{') depth++;
+    if (len == 1 && *w == '}' && --depth == 0) {
+      string definition(body, w);
+      definition.erase(0, definition.find_first_not_of(" \t\n"));
+      definition.erase(definition.find_last_not_of(" \t\n;") + 1);
+      *def = new Process((char *)("function " + name).c_str(), 0, 0);
+      (*def)->definition = definition;
+      return w + 1;
+    }
+    w += len;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Removes a `qos CLASS` prefix from p's tokens.
+ * @return The class, or QOS_NORMAL if p has no valid prefix; an invalid
+ * one is left for builtin_qos() to report.
+ */
+static int take_qos_prefix(Process *p) {
+  QosClass qos;
+  if (!p->cmdTokens[0] || strcmp(p->cmdTokens[0], "qos") != 0 ||
+      !p->cmdTokens[1] || !parse_qos(p->cmdTokens[1], &qos) ||
+      !p->cmdTokens[2]) {
+    return QOS_NORMAL;
+  }
+  int i = 0;
+  do {
+    p->cmdTokens[i] = p->cmdTokens[i + 2];
+  } while (p->cmdTokens[i++]);
+  return qos;
+}
+
 /**
  * Parses the given command string and populates a list of Process objects.
  *
  * This function takes a command string and a reference to a list of Process
- * pointers. It tokenizes the command based on the delimiters "|;" and creates a
- * new Process object for each token. The created Process objects are added to
- * the provided process_list. Additionally, it sets pipe flags for each Process
- * based on the presence of pipe delimiters '|' in the original command string.
+ * pointers. It splits the command on the delimiters "|;" and creates a new
+ * Process object for each non-empty piece. The created Process objects are
+ * added to the provided process_list. Additionally, it sets pipe flags for
+ * each Process based on which delimiter ended the previous and current piece.
  *
  * @param cmd The command string to be parsed.
  * @param process_list A reference to a list of Process pointers where the
  * created Process objects will be stored.
  *
- * Hints for students:
- * - The 'delimiters' variable holds the characters used to tokenize the command
- * string.
- * - 'pipe_in_val' is a flag indicating whether the current Process should take
- * input from a previous Process (1 if true, 0 if false).
+ * @note
  * - 'cmd_copy' is a duplicate of the original command string, and it's used to
- *   preserve the original string while tokenizing.
- * - 'currProcess' is a pointer to the current Process being created and added
- * to the list.
- * - The function uses strtok to tokenize the command based on delimiters and
- * iterates through the resulting tokens.
- * - For each token, a new Process object is created with relevant information,
- * and the pipe flags are set based on the presence of '|' in the original
- * command.
- * - The created Process objects are added to the process_list.
- * - After parsing, the memory allocated for 'cmd_copy' is freed.
+ *   preserve the original string while splitting.
+ * - strpbrk is used instead of strtok so that the delimiter which ended each
+ *   piece is still known when the next piece is created.
+ * - Empty pieces (e.g. the tail of "ls;") are skipped, and a trailing '|' with
+ *   nothing after it does not leave the last Process piping out.
+ * - A `while ...; do ...; done` loop becomes a single Process (see
+ *   parse_while()), which may itself be a pipeline stage, and so does a
+ *   function definition (see parse_function()).
+ * - Aliases and function calls are expanded (see expand_definitions()).
+ * - A `qos CLASS` prefix is taken off the first stage of a pipeline and
+ *   recorded in every stage of it.
  * - Finally, the split_string() method is called for each Process in the
- * process_list.
+ *   process_list.
  */
 void parse_input(char *cmd, list<Process *> &process_list) {
+  set<string> expanding;
+  parse_input(cmd, process_list, expanding);
+}
+
+void parse_input(char *cmd, list<Process *> &process_list,
+                 set<string> &expanding) {
   const char *delimiters = "|;";
   int pipe_in_val = 0;
   char *cmd_copy = strdup(cmd);
-  //Process *currProcess = nullptr;
-  char* token = strtok(cmd_copy, delimiters);
-  char* next;
-  while(token != NULL){
-    // check next for |
-    next = strtok(NULL, delimiters);
-    int pipe_out_val = (*strtok(NULL, "") == '|' && next) ? 1 : 0;
-    
-    // create new process
-    Process* newProc = new Process(token, pipe_in_val, pipe_out_val); 
-
-    // add to list
-    process_list.push_back(newProc);
+  Process *last = nullptr;
+  char *token = cmd_copy;
+  while (token != NULL) {
+    // a loop or a function definition is one command, whatever delimiters
+    // its body holds
+    Process *loop = nullptr;
+    char *rest = token;
+    char *start = token + strspn(token, " \t\n");
+    char *after = is_word(start, "while")
+                      ? parse_while(start, &loop, expanding)
+                      : parse_function(start, &loop);
+    if (after) rest = after;
+
+    // find the delimiter that ends this command, if any
+    char *delim = strpbrk(rest, delimiters);
+    int pipe_out_val = (delim && *delim == '|') ? 1 : 0;
+    char *next = NULL;
+    if (delim) {
+      *delim = '\0';
+      next = delim + 1;
+    }
+
+    if (loop) {
+      loop->pipe_in = pipe_in_val;
+      loop->pipe_out = pipe_out_val;
+      last = loop;
+      process_list.push_back(last);
+      pipe_in_val = pipe_out_val;
+    } else if (token[strspn(token, " \t\n")] != '\0') {
+      // skip empty commands
+      last = new Process(token, pipe_in_val, pipe_out_val);
+      process_list.push_back(last);
+      pipe_in_val = pipe_out_val;
+    }
 
     // iterate to next token
     token = next;
-    pipe_in_val = pipe_out_val;
   }
+  if (last) last->pipe_out = false;
 
   // free cmd_cpy
   free(cmd_copy);
@@ -173,13 +414,27 @@ void parse_input(char *cmd, list<Process *> &process_list) {
   for (Process* p : process_list){
     p->split_string();
   }
+
+  expand_definitions(process_list, expanding);
+
+  // a `qos CLASS` prefix applies to every stage of its pipeline; a pipeline
+  // from an alias already had its own taken off
+  int qos = QOS_NORMAL;
+  for (Process *p : process_list) {
+    if (!p->pipe_in) {
+      qos = take_qos_prefix(p);
+      if (qos == QOS_NORMAL) qos = p->qos;
+    }
+    p->qos = qos;
+  }
 }
 
 /**
  * Check if the given command represents a quit request.
  *
  * This function compares the first token of the provided command with the
- * string "quit" to determine if the command is a quit request.
+ * string "quit" to determine if the command is a quit request. split_string()
+ * must have been called on the Process first.
  *
  * Parameters:
  *   - p: A pointer to a Process structure representing the command.
@@ -189,12 +444,8 @@ void parse_input(char *cmd, list<Process *> &process_list) {
  *   - false otherwise.
  */
 bool isQuit(Process *p) {
-  if (!p || !(p->cmd)){return false;}
-  char* cpy_cmd = strdup((p->cmd));
-  char* cmd = strtok(p->cmd, "");
-  bool isQuit = strcmp(cmd, "quit") == 0;
-  free(cpy_cmd);
-  return isQuit;
+  if (!p || !(p->cmdTokens[0])){return false;}
+  return strcmp(p->cmdTokens[0], "quit") == 0;
 }
 
 /**
@@ -216,9 +467,11 @@ bool isQuit(Process *p) {
  * The function iterates through the provided list of processes and performs the
  * following steps:
  * 1. Check if a quit command is encountered. If yes, terminate execution.
- * 2. Create pipes and fork a child process for each command.
- * 3. In the parent process, close unused pipes, wait for child processes to
- * finish if necessary, and continue to the next command.
+ * 2. Create pipes and start a job for each command through the launcher (the
+ * default PosixLauncher forks a child process).
+ * 3. In the parent process, close unused pipes and continue to the next
+ * command. Once the last stage of a pipeline is started, wait for every stage
+ * of that pipeline, so all stages of a pipeline run concurrently.
  * 4. In the child process, set up pipes for input and output, execute the
  * command using execvp, and handle errors if the command is invalid.
  * 5. Cleanup final process and wait for all child processes to finish.
@@ -245,66 +498,167 @@ bool isQuit(Process *p) {
  * execution in Unix-like systems.
  */
 bool run_commands(list<Process *> &command_list) {
+  static PosixLauncher launcher;
+  return run_commands(command_list, launcher);
+}
+
+/**
+ * @brief A copy of p with its variables expanded (see expand_word()), or
+ * null if it has none.
+ *
+ * The expanded line is split into words again, as sh splits unquoted
+ * expansions. A loop is never copied; its body is expanded when it runs.
+ */
+static Process *expand_process(Process *p) {
+  if (!p->body.empty()) return nullptr;
+  string line, word;
+  bool any = false;
+  for (int i = 0; p->cmdTokens[i]; i++) {
+    if (expand_word(p->cmdTokens[i], &word)) {
+      line += word;
+      any = true;
+    } else {
+      line += p->cmdTokens[i];
+    }
+    line += ' ';
+  }
+  if (!any) return nullptr;
+  Process *e = new Process((char *)line.c_str(), p->pipe_in, p->pipe_out);
+  e->split_string();
+  e->qos = p->qos;
+  return e;
+}
+
+/**
+ * @brief Execute a list of commands through the given launcher.
+ *
+ * This is run_commands() with the process system calls (pipe, fork, dup2,
+ * execvp, waitpid) replaced by the launcher, so the same scheduling logic can
+ * drive real processes or a simulation.
+ *
+ * @param command_list A list of Process pointers representing the commands to
+ * execute.
+ * @param launcher The backend used to create pipes and start and wait for
+ * jobs.
+ * @param in_fd stdin of the first stage of each pipeline, or -1 to inherit.
+ * @param out_fd stdout of the last stage of each pipeline, or -1 to inherit.
+ * @param err_fd stderr of every stage, or -1 to inherit.
+ * @param status If not null, receives the exit code (see exit_code()) of the
+ * last stage of the last pipeline that ran, or 0 if none ran.
+ *
+ * @return true if a quit command was encountered; otherwise, false.
+ */
+bool run_commands(list<Process *> &command_list, ProcessLauncher &launcher,
+                  int in_fd, int out_fd, int err_fd, int *status) {
   bool is_quit = false;
-  //int i = 0;
-  //int j = 0;
-  //int size = command_list.size();
-  //pid_t pids[size];
-  Process *prev = nullptr;
-  int prev_fd[2];
+  // read end of the pipe feeding the next stage, if any
+  int prev_read = -1;
+  // jobs of the pipeline currently being launched
+  vector<pid_t> jobs;
+  int last_status = 0;
+  // copies of commands with their variables expanded, kept until the end
+  // since their jobs use them
+  list<Process *> expanded;
+  cout << flush;
   for (Process* p : command_list){
+    // `NAME=VALUE ...` sets shell variables; in a pipeline it would only
+    // set them in a subshell, so there it does nothing
+    if (is_assignment_list(p) && !p->pipe_in && !p->pipe_out) {
+      assign_variables(p);
+      last_status = 0;
+      continue;
+    }
+    if (Process *e = expand_process(p)) {
+      expanded.push_back(e);
+      p = e;
+    }
+    // a command that expanded to nothing does nothing; in a pipeline it
+    // still needs a stage, which reads and writes nothing
+    if (!p->cmdTokens[0] || is_assignment_list(p)) {
+      if (!p->pipe_in && !p->pipe_out) {
+        last_status = 0;
+        continue;
+      }
+      p->cmd = (char *)realloc(p->cmd, sizeof("true"));
+      strcpy(p->cmd, "true");
+      p->split_string();
+    }
+
     // check quit
     if (isQuit(p)){
       is_quit = true;
       break;
     }
 
-    // check if new pipe is needed
-    // fork
-    int pid = fork();
-    if (pid == -1){
-      exit(1);
+    // a builtin or a function call on its own runs in the shell process,
+    // unless it has to be demoted, which would demote the shell too
+    if (p->call && !p->pipe_in && !p->pipe_out && p->qos == QOS_NORMAL) {
+      last_status = (run_call(p, in_fd, out_fd, err_fd) & 0xff) << 8;
+      continue;
+    }
+    const Builtin *builtin = p->call ? nullptr : find_builtin(p->cmdTokens[0]);
+    if (builtin && !p->pipe_in && !p->pipe_out && p->qos == QOS_NORMAL) {
+      int code = builtin->fn(p, in_fd == -1 ? STDIN_FILENO : in_fd,
+                             out_fd == -1 ? STDOUT_FILENO : out_fd,
+                             err_fd == -1 ? STDERR_FILENO : err_fd);
+      last_status = (code & 0xff) << 8;
+      continue;
     }
 
-    int fd[2];
-    if(pipe(fd) == -1) exit(1);
-      // if child
-    if (pid == 0) {
-        // set up pipes for input and output
-        // prev pipes out
-        if (p->pipe_in) dup2(prev_fd[1], STDIN_FILENO);
-
-        if (prev) {
-          //if (prev->pipe_out) dup2(prev_fd[0], STDOUT_FILENO);
-          close(prev_fd[0]);
-          close(prev_fd[1]);
-        }
-        // if it pipes out
-        if(p->pipe_out) dup2(fd[1], STDOUT_FILENO);
-        close(fd[0]);
-        close(fd[1]);
-
-        // execute the command using execvp
-        execvp(p->cmdTokens[0], p->cmdTokens);
-        // handle errors if the command is invalid.
-        exit(1);
-    } else if (pid > 0){
-      // if parent
-        // close unused pipes
-        if (prev) {
-          close(prev_fd[0]);
-          close(prev_fd[1]);
-        }
-
-        // wait for child processes to finish if necessary,
-        wait(&pid);
-        // continue to the next command.
+    // create the pipe before launching so both sides can use it
+    int fd[2] = {-1, -1};
+    if (p->pipe_out && launcher.make_pipe(fd) == -1) {
+      perror("tsh: pipe");
+      break;
+    }
+
+    pid_t job = launcher.launch(p, p->pipe_in ? prev_read : in_fd,
+                                p->pipe_out ? fd[1] : out_fd, err_fd);
+    if (job == -1) {
+      perror("tsh: fork");
+      if (p->pipe_out) {
+        launcher.close_fd(fd[0]);
+        launcher.close_fd(fd[1]);
+      }
+      break;
+    }
+
+    // close the pipe ends that now belong to the job
+    if (prev_read != -1) launcher.close_fd(prev_read);
+    prev_read = -1;
+    if (p->pipe_out) {
+      launcher.close_fd(fd[1]);
+      prev_read = fd[0];
+    }
+    jobs.push_back(job);
+
+    // the pipeline is complete; wait for all of its stages together so that
+    // stages run concurrently and a full pipe never blocks the writer forever
+    if (!p->pipe_out) {
+      for (pid_t j : jobs) last_status = launcher.wait_job(j);
+      jobs.clear();
     }
-    prev = p;
   }
+
+  // a quit or error can stop the list in the middle of a pipeline
+  if (prev_read != -1) launcher.close_fd(prev_read);
+  for (pid_t j : jobs) last_status = launcher.wait_job(j);
+  cleanup(expanded, nullptr);
+  if (status) *status = exit_code(last_status);
   return is_quit;
 }
 
+/**
+ * @brief Converts a wait status into a shell exit code.
+ *
+ * @return The exit status of a job that exited, or 128 + the signal number
+ * for a job that was killed by a signal, as other shells report it.
+ */
+int exit_code(int wait_status) {
+  if (WIFSIGNALED(wait_status)) return 128 + WTERMSIG(wait_status);
+  return WEXITSTATUS(wait_status);
+}
+
 /**
  * @brief Constructor for Process class.
  *
@@ -317,16 +671,48 @@ bool run_commands(list<Process *> &command_list) {
  */
 Process::Process(char *_cmd, int _pipe_in, int _pipe_out) {
   cmd = strdup(_cmd);
+  cmdTokens[0] = NULL;
   pipe_in = _pipe_in;
   pipe_out = _pipe_out;
+  qos = QOS_NORMAL;
+  call = false;
+}
+
+/**
+ * @brief A copy of a split Process, including the commands of its body.
+ *
+ * The tokenized command string is copied as it is and the token pointers
+ * moved into the copy, so nothing is split again.
+ */
+Process *Process::clone() const {
+  size_t len = 0;
+  for (int i = 0; cmdTokens[i]; i++) {
+    len = cmdTokens[i] + strlen(cmdTokens[i]) - cmd;
+  }
+  Process *c = new Process((char *)"", pipe_in, pipe_out);
+  c->cmd = (char *)realloc(c->cmd, len + 1);
+  memcpy(c->cmd, cmd, len);
+  c->cmd[len] = '\0';
+  int i = 0;
+  for (; cmdTokens[i]; i++) c->cmdTokens[i] = c->cmd + (cmdTokens[i] - cmd);
+  c->cmdTokens[i] = NULL;
+  for (Process *b : body) c->body.push_back(b->clone());
+  c->qos = qos;
+  c->call = call;
+  c->definition = definition;
+  return c;
 }
 
 /**
  * @brief Destructor for Process class.
  *
- * Frees the dynamically allocated memory for the command string.
+ * Frees the dynamically allocated memory for the command string and the
+ * commands of a loop body.
  */
-Process::~Process() { free(cmd); }
+Process::~Process() {
+  free(cmd);
+  for (Process *p : body) delete p;
+}
 
 /**
  * @brief Tokenizes the command string into an array of strings.
@@ -335,12 +721,21 @@ Process::~Process() { free(cmd); }
  * resulting tokens in the cmdTokens array. The tokens can be accessed using
  * cmdTokens[index].
  *
- * @note Ensure that the cmdTokens array has sufficient space to store the
- * tokens.
+ * @note At most MAX_TOKENS - 1 tokens are kept; any further tokens are
+ * dropped so that cmdTokens is always NULL-terminated for execvp.
  *
  * @warning This method uses strtok function which modifies the input string.
  * Ensure that the original command string is not needed after calling this
  * method.
  */
 void Process::split_string() {
+  const char *delimiters = " \t\n";
+  int i = 0;
+  char *token = strtok(cmd, delimiters);
+  // leave room for the NULL terminator execvp expects
+  while (token != NULL && i < MAX_TOKENS - 1) {
+    cmdTokens[i++] = token;
+    token = strtok(NULL, delimiters);
+  }
+  cmdTokens[i] = NULL;
 }
@@ -0,0 +1,220 @@
+#include <alias.h>
+#include <variables.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+extern char **environ;
+
+static inline bool is_name_char(char c, bool first) {
+  return c == '_' || isalpha((unsigned char)c) ||
+         (!first && isdigit((unsigned char)c));
+}
+
+// never destroyed: builtin threads may still be running at exit
+static mutex &vars_lock = *new mutex;
+static map<string, string> &scalars = *new map<string, string>;
+static map<string, vector<string>> &arrays = *new map<string, vector<string>>;
+
+void set_variable(const string &name, const string &value) {
+  lock_guard<mutex> guard(vars_lock);
+  scalars[name] = value;
+}
+
+void set_array(const string &name, const vector<string> &elements) {
+  lock_guard<mutex> guard(vars_lock);
+  arrays[name] = elements;
+}
+
+bool get_variable(const string &name, string *value) {
+  {
+    lock_guard<mutex> guard(vars_lock);
+    auto it = scalars.find(name);
+    if (it != scalars.end()) {
+      *value = it->second;
+      return true;
+    }
+  }
+  const char *env = getenv(name.c_str());
+  if (!env) return false;
+  *value = env;
+  return true;
+}
+
+
+void unset_variable(const string &name) {
+  {
+    lock_guard<mutex> guard(vars_lock);
+    scalars.erase(name);
+    arrays.erase(name);
+  }
+  unsetenv(name.c_str());
+}
+
+void export_variable(const string &name, const char *value) {
+  string shell_value;
+  {
+    lock_guard<mutex> guard(vars_lock);
+    auto it = scalars.find(name);
+    if (it != scalars.end()) {
+      shell_value = move(it->second);
+      scalars.erase(it);
+      if (!value) value = shell_value.c_str();
+    }
+  }
+  // the environment's value is the only one, so $NAME sees later exports
+  if (value) setenv(name.c_str(), value, 1);
+}
+
+void export_variables(const vector<string> &names) {
+  map<string, string> values;
+  {
+    lock_guard<mutex> guard(vars_lock);
+    for (const string &name : names) {
+      auto it = scalars.find(name);
+      if (it == scalars.end()) continue;
+      values[name] = move(it->second);
+      scalars.erase(it);
+    }
+  }
+  if (values.empty()) return;
+  vector<char *> env;
+  for (char **e = environ; *e; e++) {
+    const char *eq = strchr(*e, '=');
+    if (eq && values.count(string((const char *)*e, eq))) continue;
+    env.push_back(*e);
+  }
+  // never freed, like the strings setenv() adds: they are the environment
+  for (auto &v : values) {
+    env.push_back(strdup((v.first + "=" + v.second).c_str()));
+  }
+  env.push_back(nullptr);
+  char **array = new char *[env.size()];
+  copy(env.begin(), env.end(), array);
+  environ = array;
+}
+
+bool is_assignment(const char *word) {
+  if (!is_name_char(word[0], true)) return false;
+  const char *s = word + 1;
+  while (is_name_char(*s, false)) s++;
+  return *s == '=';
+}
+
+bool is_assignment_list(Process *p) {
+  if (!p->cmdTokens[0] || !p->body.empty()) return false;
+  for (int i = 0; p->cmdTokens[i]; i++) {
+    if (!is_assignment(p->cmdTokens[i])) return false;
+  }
+  return true;
+}
+
+void assign_variables(Process *p) {
+  for (int i = 0; p->cmdTokens[i]; i++) {
+    const char *eq = strchr(p->cmdTokens[i], '=');
+    string value;
+    if (!expand_word(eq + 1, &value)) value = eq + 1;
+    set_variable(string((const char *)p->cmdTokens[i], eq), value);
+  }
+}
+
+/**
+ * @brief Value of what is inside ${...}: NAME, NAME[I] or #NAME[@].
+ */
+static string lookup(const string &ref) {
+  size_t open = ref.find('[');
+  if (open == string::npos || ref.back() != ']') {
+    string value;
+    get_variable(ref, &value);
+    return value;
+  }
+  bool count = ref[0] == '#';
+  string name = ref.substr(count, open - count);
+  string index = ref.substr(open + 1, ref.size() - open - 2);
+  lock_guard<mutex> guard(vars_lock);
+  auto it = arrays.find(name);
+  if (count) return to_string(it == arrays.end() ? 0 : it->second.size());
+  if (it == arrays.end()) return "";
+  char *end;
+  unsigned long i = strtoul(index.c_str(), &end, 10);
+  if (*end || index.empty() || i >= it->second.size()) return "";
+  return it->second[i];
+}
+
+bool expand_word(const char *word, string *out) {
+  const char *dollar = strchr(word, '$');
+  if (!dollar) return false;
+  string result(word, dollar);
+  bool expanded = false;
+  for (const char *s = dollar; *s;) {
+    if (*s != '$') {
+      result += *s++;
+      continue;
+    }
+    if (s[1] == '{') {
+      const char *close = strchr(s + 2, '}');
+      if (close) {
+        result += lookup(string(s + 2, close));
+        s = close + 1;
+        expanded = true;
+        continue;
+      }
+    } else if (is_name_char(s[1], true)) {
+      const char *end = s + 2;
+      while (is_name_char(*end, false)) end++;
+      string value;
+      get_variable(string(s + 1, end), &value);
+      result += value;
+      s = end;
+      expanded = true;
+      continue;
+    }
+    result += *s++;
+  }
+  if (!expanded) return false;
+  *out = move(result);
+  return true;
+}
+
+int builtin_export(Process *p, int, int out_fd, int err_fd) {
+  if (!p->cmdTokens[1]) {
+    string listing;
+    for (char **env = environ; *env; env++) {
+      listing += "export ";
+      listing += *env;
+      listing += '\n';
+    }
+    write(out_fd, listing.data(), listing.size());
+    return 0;
+  }
+  int status = 0;
+  for (int i = 1; p->cmdTokens[i]; i++) {
+    const char *word = p->cmdTokens[i];
+    const char *eq = strchr(word, '=');
+    string name = eq ? string(word, eq) : string(word);
+    if (name.empty() || !is_name_char(name[0], true) ||
+        !all_of(name.begin() + 1, name.end(),
+                [](char c) { return is_name_char(c, false); })) {
+      dprintf(err_fd, "tsh: export: %s: not a valid name\n", word);
+      status = 1;
+      continue;
+    }
+    export_variable(name, eq ? eq + 1 : nullptr);
+  }
+  return status;
+}
+
+int builtin_unset(Process *p, int, int, int) {
+  bool functions = p->cmdTokens[1] && strcmp(p->cmdTokens[1], "-f") == 0;
+  for (int i = 1 + functions; p->cmdTokens[i]; i++) {
+    if (functions) {
+      remove_function(p->cmdTokens[i]);
+    } else {
+      unset_variable(p->cmdTokens[i]);
+    }
+  }
+  return 0;
+}
@@ -1,9 +1,32 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <gtest/gtest.h>
 #include <fstream>
 #include <iostream>
 #include <string>
 
+#include <launcher.h>
+#include <alias.h>
+#include <complete.h>
+#include <editor.h>
+#include <fileutils.h>
+#include <forkless.h>
+#include <grep.h>
+#include <history.h>
+#include <libtsh.h>
+#include <lineread.h>
+#include <pathcache.h>
+#include <prompt.h>
+#include <qos.h>
+#include <rc.h>
+#include <record.h>
+#include <speculate.h>
+#include <textutils.h>
+#include <topology.h>
 #include <tsh.h>
+#include <variables.h>
 
 using namespace std;
 
@@ -24,6 +47,690 @@ TEST(ShellTest, NotQuit) {
   EXPECT_FALSE(isQuit(&p)) << "passing quit should return true" << endl;
 }
 
+// pipeline stages run concurrently: the pipeline costs its slowest stage
+TEST(LauncherTest, PipelineStagesOverlap) {
+  FakeLauncher launcher;
+  launcher.set_program("gen", 100, "data\n");
+  launcher.set_program("cat", 300, "", 0, true);
+  list<Process *> process_list;
+  parse_input((char *)"gen | cat | cat", process_list);
+
+  EXPECT_FALSE(run_commands(process_list, launcher));
+  EXPECT_EQ(launcher.now_ns, 300);
+  EXPECT_EQ(launcher.stdout_data, "data\n");
+  EXPECT_EQ(launcher.launched, 3u);
+  EXPECT_EQ(launcher.open_fds, 0u) << "pipe ends leaked" << endl;
+  cleanup(process_list, nullptr);
+}
+
+// ';' separated pipelines run one after another
+TEST(LauncherTest, SequentialListAddsUp) {
+  FakeLauncher launcher;
+  launcher.set_program("a", 100, "a\n");
+  launcher.set_program("b", 50, "b\n");
+  list<Process *> process_list;
+  parse_input((char *)"a; b; a", process_list);
+
+  run_commands(process_list, launcher);
+  EXPECT_EQ(launcher.now_ns, 250);
+  EXPECT_EQ(launcher.stdout_data, "a\nb\na\n");
+  cleanup(process_list, nullptr);
+}
+
+// quit stops the list and unknown commands still get waited for
+TEST(LauncherTest, QuitStopsList) {
+  FakeLauncher launcher;
+  launcher.set_program("a", 10, "a\n");
+  list<Process *> process_list;
+  parse_input((char *)"missing; a; quit; a", process_list);
+
+  EXPECT_TRUE(run_commands(process_list, launcher));
+  EXPECT_EQ(launcher.launched, 2u);
+  EXPECT_EQ(launcher.stdout_data, "a\n");
+  cleanup(process_list, nullptr);
+}
+
+static size_t open_fds() {
+  size_t n = 0;
+  DIR *dir = opendir("/proc/self/fd");
+  while (readdir(dir)) n++;
+  closedir(dir);
+  return n;
+}
+
+/**
+ * @brief A PosixLauncher that notes when each stage was launched and the
+ * most descriptors the shell had open meanwhile, and closes the write end of
+ * the first stage's input once the last stage is up.
+ */
+class WatchedLauncher : public PosixLauncher {
+ public:
+  explicit WatchedLauncher(int _feed) : feed(_feed), max_fds(0) {}
+
+  pid_t launch(Process *p, int in_fd, int out_fd, int err_fd) override {
+    pid_t job = PosixLauncher::launch(p, in_fd, out_fd, err_fd);
+    launched.push_back(chrono::steady_clock::now());
+    max_fds = max(max_fds, open_fds());
+    if (!p->pipe_out) close(feed);
+    return job;
+  }
+
+  int feed;
+  size_t max_fds;
+  vector<chrono::steady_clock::time_point> launched;
+};
+
+// a 10,000 stage chain of cats launches in linear time and the shell keeps
+// a bounded number of descriptors while every stage is alive
+TEST(LauncherTest, LongPipelineScales) {
+  const int stages = 10000;
+  string line = "cat";
+  for (int i = 1; i < stages; i++) line += " | cat";
+  list<Process *> process_list;
+  parse_input((char *)line.c_str(), process_list);
+  ASSERT_EQ(process_list.size(), (size_t)stages);
+
+  char path[] = "/tmp/tsh_chain_XXXXXX";
+  int out = mkstemp(path);
+  ASSERT_NE(out, -1);
+  int feed[2];
+  ASSERT_EQ(pipe2(feed, O_CLOEXEC), 0);
+  ASSERT_EQ(write(feed[1], "hi\n", 3), 3);
+  size_t base_fds = open_fds();
+  WatchedLauncher launcher(feed[1]);
+  int status = -1;
+  run_commands(process_list, launcher, feed[0], out, -1, &status);
+  close(feed[0]);
+  EXPECT_EQ(status, 0);
+
+  char buf[8] = {};
+  EXPECT_EQ(pread(out, buf, sizeof(buf), 0), 3);
+  EXPECT_STREQ(buf, "hi\n");
+  close(out);
+  unlink(path);
+
+  // every cat waits on the one before it, so all are alive at the end
+  EXPECT_LE(launcher.max_fds, base_fds + 3 * BUILTIN_THREADS + 8);
+  ASSERT_EQ(launcher.launched.size(), (size_t)stages);
+  // the last thousand stages launch about as fast as the first thousand;
+  // a cost growing with the stages already up would make them ~20x slower
+  auto first = launcher.launched[1000] - launcher.launched[0];
+  auto last = launcher.launched[stages - 1] - launcher.launched[stages - 1001];
+  EXPECT_LT(last, 3 * first);
+  cleanup(process_list, nullptr);
+}
+
+// a parsed pipeline runs on in-memory buffers and can be reused
+TEST(LibtshTest, RunWithBuffers) {
+  Pipeline upper("tr a-z A-Z | cat");
+  string out;
+  EXPECT_EQ(upper.run("hello\n", &out), 0);
+  EXPECT_EQ(out, "HELLO\n");
+
+  out.clear();
+  EXPECT_EQ(upper.run("again\n", &out), 0);
+  EXPECT_EQ(out, "AGAIN\n");
+}
+
+// exit codes are reported through run() and futures
+TEST(LibtshTest, StatusAndFuture) {
+  EXPECT_EQ(Pipeline("false").run(), 1);
+  int null_fd = open("/dev/null", O_WRONLY);
+  EXPECT_EQ(Pipeline("no-such-command-tsh").run(-1, -1, null_fd), 127);
+  close(null_fd);
+
+  Pipeline count("wc -l");
+  string out;
+  future<int> status = count.run_async("a\nb\nc\n", &out);
+  EXPECT_EQ(status.get(), 0);
+  EXPECT_EQ(atoi(out.c_str()), 3);
+}
+// the PATH cache resolves like execvp and skips names with a '/'
+TEST(PathCacheTest, Lookup) {
+  string sh = path_lookup("sh");
+  ASSERT_FALSE(sh.empty());
+  EXPECT_EQ(sh.substr(sh.size() - 3), "/sh");
+  EXPECT_EQ(path_lookup("sh"), sh);
+  EXPECT_EQ(path_lookup("no-such-command-tsh"), "");
+  EXPECT_EQ(path_lookup("./sh"), "");
+}
+// history entries survive sessions and are searchable with and without
+// the index
+TEST(HistoryTest, PersistAndSearch) {
+  char path[] = "/tmp/tsh_history_XXXXXX";
+  close(mkstemp(path));
+  {
+    History h(path);
+    h.add("ls -l");
+    h.add("make test");
+    h.add("git status");
+    vector<string> found = h.search("st", 10);
+    ASSERT_EQ(found.size(), 2u);
+    EXPECT_EQ(found[0], "git status");
+    EXPECT_EQ(found[1], "make test");
+  }
+  History h(path);
+  string entry;
+  ASSERT_TRUE(h.recent(0, &entry));
+  EXPECT_EQ(entry, "git status");
+  ASSERT_TRUE(h.recent(2, &entry));
+  EXPECT_EQ(entry, "ls -l");
+  EXPECT_FALSE(h.recent(3, &entry));
+  h.sync();
+  vector<string> found = h.search("make", 10);
+  ASSERT_EQ(found.size(), 1u);
+  EXPECT_EQ(found[0], "make test");
+  unlink(path);
+  unlink((string(path) + ".lock").c_str());
+}
+
+// compaction drops duplicates and keeps only the newest entries
+TEST(HistoryTest, Compaction) {
+  char path[] = "/tmp/tsh_history_XXXXXX";
+  close(mkstemp(path));
+  {
+    History h(path, 3);
+    for (const char *line : {"a", "b", "a", "c", "b", "d"}) h.add(line);
+  }
+  {
+    History h(path, 3);
+    h.sync();
+  }
+  ifstream in(path);
+  string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  EXPECT_EQ(contents, "c\nb\nd\n");
+  unlink(path);
+  unlink((string(path) + ".lock").c_str());
+}
+// command names come from $PATH, later words complete as paths
+TEST(CompleteTest, CommandsAndPaths) {
+  Completer completer;
+  vector<string> found = completer.complete("ech").get();
+  EXPECT_NE(find(found.begin(), found.end(), "echo"), found.end());
+  found = completer.complete("ls | hist").get();
+  EXPECT_NE(find(found.begin(), found.end(), "history"), found.end());
+
+  char dir[] = "/tmp/tsh_complete_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  string base = dir;
+  mkdir((base + "/subdir").c_str(), 0700);
+  close(open((base + "/file.txt").c_str(), O_CREAT | O_WRONLY, 0600));
+  found = completer.complete("cat " + base + "/").get();
+  ASSERT_EQ(found.size(), 2u);
+  EXPECT_EQ(found[0], base + "/file.txt");
+  EXPECT_EQ(found[1], base + "/subdir/");
+  unlink((base + "/file.txt").c_str());
+  rmdir((base + "/subdir").c_str());
+  rmdir(dir);
+}
+// prompt segments render from the recorded command state without waiting
+TEST(PromptTest, Segments) {
+  prompt_command_done(3, 1500);
+  EXPECT_EQ(render_prompt("[\\?] \\d \\\\ \\$"),
+            string("[3] 1.5s \\ ") + (getuid() == 0 ? "#" : "$"));
+  prompt_command_done(0, 42);
+  EXPECT_EQ(render_prompt("\\? \\d"), "0 42ms");
+  EXPECT_EQ(prompt_width(render_prompt("\\e[1;32mok\\e[0m> ")), 4u);
+}
+// a speculated line is handed over already parsed, any other is not
+TEST(SpeculateTest, ParseHandedOver) {
+  speculate("echo hi | wc -c");
+  list<Process *> process_list;
+  EXPECT_FALSE(take_speculation("echo other", process_list));
+  ASSERT_TRUE(take_speculation("echo hi | wc -c", process_list));
+  ASSERT_EQ(process_list.size(), 2u);
+  EXPECT_STREQ(process_list.back()->cmdTokens[1], "-c");
+  EXPECT_TRUE(process_list.front()->pipe_out);
+  cleanup(process_list, nullptr);
+  EXPECT_FALSE(take_speculation("echo hi | wc -c", process_list));
+}
+// keys edit the line; a 100 KB paste goes in whole for one row of output
+TEST(EditorTest, KeysAndPaste) {
+  int in[2], out[2];
+  ASSERT_EQ(pipe(in), 0);
+  ASSERT_EQ(pipe(out), 0);
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  LineEditor editor(in[0], out[1]);
+  string keys = "echo hellp\x7fo\x01# \x05 x\x17\x01\x19\r";
+  ASSERT_EQ(write(in[1], keys.data(), keys.size()), (ssize_t)keys.size());
+  string line;
+  ASSERT_TRUE(editor.read_line("> ", &line));
+  EXPECT_EQ(line, "x# echo hello ");
+
+  string paste = "\033[200~" + string(100000, 'x') + "\n\033[201~\r";
+  thread writer([&]() {
+    ASSERT_EQ(write(in[1], paste.data(), paste.size()), (ssize_t)paste.size());
+  });
+  char drain[65536];
+  while (read(out[0], drain, sizeof(drain)) > 0) {
+  }
+  ASSERT_TRUE(editor.read_line("> ", &line));
+  writer.join();
+  EXPECT_EQ(line, string(100000, 'x') + ";");
+  ssize_t shown = read(out[0], drain, sizeof(drain));
+  EXPECT_LT(shown, 2048) << "paste redrew more than the visible row" << endl;
+
+  ASSERT_EQ(write(in[1], "\x04", 1), 1);
+  EXPECT_FALSE(editor.read_line("> ", &line));
+  close(in[1]);
+  close(out[0]);
+}
+// cat and cp run without forking and copy every byte, in and out of pipes
+TEST(FileUtilsTest, CatAndCp) {
+  char dir[] = "/tmp/tsh_files_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  string base = dir, data;
+  for (int i = 0; data.size() < (3 << 20); i++) data += to_string(i) + "\n";
+  ofstream(base + "/a") << data;
+
+  string out;
+  EXPECT_EQ(Pipeline(("cat " + base + "/a | cat - | cat").c_str()).run("", &out),
+            0);
+  EXPECT_TRUE(out == data) << "cat through pipes changed the data" << endl;
+  out.clear();
+  EXPECT_EQ(Pipeline("cat | cat").run("in\n", &out), 0);
+  EXPECT_EQ(out, "in\n");
+  EXPECT_EQ(Pipeline(("cat " + base + "/missing").c_str()).run("", &out), 1);
+
+  mkdir((base + "/d").c_str(), 0700);
+  EXPECT_EQ(Pipeline(("cp " + base + "/a " + base + "/b").c_str()).run(), 0);
+  EXPECT_EQ(Pipeline(("cp " + base + "/a " + base + "/d").c_str()).run(), 0);
+  for (const char *name : {"/b", "/d/a"}) {
+    ifstream in(base + name);
+    string copy((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    EXPECT_TRUE(copy == data) << name << " differs" << endl;
+    unlink((base + name).c_str());
+  }
+  unlink((base + "/a").c_str());
+  rmdir((base + "/d").c_str());
+  rmdir(dir);
+}
+// SIMD counting agrees with a plain loop at every length and alignment;
+// head stops its producer, tail reads files from the end
+TEST(TextUtilsTest, CountHeadTail) {
+  string text;
+  for (int i = 0; i < 5000; i++) text += (i * 7919) % 13 ? 'x' : '\n';
+  for (size_t start = 0; start < 40; start++) {
+    for (size_t len : {0, 1, 15, 16, 31, 33, 64, 100, 4000}) {
+      size_t expect = count(text.begin() + start,
+                            text.begin() + start + len, '\n');
+      ASSERT_EQ(count_byte(text.data() + start, len, '\n'), expect);
+    }
+  }
+
+  string out;
+  EXPECT_EQ(Pipeline("yes | head -n 2").run("", &out), 0);
+  EXPECT_EQ(out, "y\ny\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("head -c 3 | wc -c").run("abcdef", &out), 0);
+  EXPECT_EQ(out, "3\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("wc").run("one two\nthree\n", &out), 0);
+  EXPECT_EQ(out, "      2       3      14\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("tail -n 2").run("a\nb\nc\nd\n", &out), 0);
+  EXPECT_EQ(out, "c\nd\n");
+
+  char path[] = "/tmp/tsh_tail_XXXXXX";
+  close(mkstemp(path));
+  {
+    ofstream file(path);
+    for (int i = 0; i < 100000; i++) file << i << "\n";
+  }
+  out.clear();
+  EXPECT_EQ(Pipeline((string("tail -3 ") + path).c_str()).run("", &out), 0);
+  EXPECT_EQ(out, "99997\n99998\n99999\n");
+  out.clear();
+  EXPECT_EQ(Pipeline((string("wc -l ") + path).c_str()).run("", &out), 0);
+  EXPECT_EQ(out, string("100000 ") + path + "\n");
+  unlink(path);
+}
+// the SIMD matchers find the leftmost match anywhere in the buffer, and
+// the builtin selects whole lines like grep -F
+TEST(GrepTest, FixedStrings) {
+  string text(300, 'a');
+  for (size_t at : {0, 17, 31, 32, 33, 100, 290}) {
+    for (vector<string> patterns :
+         {vector<string>{"xyz"}, vector<string>{"q", "xyz", "bb"}}) {
+      string hay = text;
+      hay.replace(at, 3, "xyz");
+      EXPECT_EQ(FixedMatcher(patterns).find(hay.data(), hay.size()), at);
+    }
+  }
+  EXPECT_EQ(FixedMatcher({"xyz"}).find(text.data(), text.size()), text.size());
+  EXPECT_EQ(FixedMatcher({"b", "c"}).find(text.data(), text.size()),
+            text.size());
+
+  string in = "alpha\nbeta\ngamma\ndelta\nepsilon";
+  string out;
+  EXPECT_EQ(Pipeline("grep -F ta").run(in, &out), 0);
+  EXPECT_EQ(out, "beta\ndelta\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("grep -n -e mm -e eps").run(in, &out), 0);
+  EXPECT_EQ(out, "3:gamma\n5:epsilon\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("grep -vc a").run(in, &out), 0);
+  EXPECT_EQ(out, "1\n");
+  EXPECT_EQ(Pipeline("grep -q zeta").run(in, nullptr), 1);
+  out.clear();
+  EXPECT_EQ(Pipeline("grep ^b").run(in, &out), 0);
+  EXPECT_EQ(out, "beta\n") << "regular expressions go to the real grep" << endl;
+}
+
+// sort orders like LC_ALL=C sort, with keys, and gives the same result when
+// it has to spill runs to disk
+TEST(SortTest, KeysAndSpill) {
+  setenv("LC_ALL", "C", 1);
+  string in = "b 10\na 9\nc -2.5\na 9\nB 010";
+  string out;
+  EXPECT_EQ(Pipeline("sort").run(in, &out), 0);
+  EXPECT_EQ(out, "B 010\na 9\na 9\nb 10\nc -2.5\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("sort -u -r").run(in, &out), 0);
+  EXPECT_EQ(out, "c -2.5\nb 10\na 9\nB 010\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("sort -n -k2").run(in, &out), 0);
+  EXPECT_EQ(out, "c -2.5\na 9\na 9\nB 010\nb 10\n");
+  out.clear();
+  EXPECT_EQ(Pipeline("sort -nu -k2,2").run(in, &out), 0);
+  EXPECT_EQ(out, "c -2.5\na 9\nb 10\n") << "-u keeps the first equal key";
+
+  // a tiny budget spills many runs that are merged back
+  string lines, expected;
+  vector<string> sorted;
+  for (int i = 0; i < 20000; i++) {
+    string line = to_string((i * 7919) % 20000) + " x";
+    lines += line + "\n";
+    sorted.push_back(line);
+  }
+  sort(sorted.begin(), sorted.end());
+  for (const string &line : sorted) expected += line + "\n";
+  out.clear();
+  EXPECT_EQ(Pipeline("sort -S 16K").run(lines, &out), 0);
+  EXPECT_EQ(out, expected);
+}
+
+// read gives back what it read too far on a file, a loop shares its pipe
+// buffer with the reads in its body, and variables expand when commands run
+TEST(LineReadTest, ReadLoopAndMapfile) {
+  char in_path[] = "/tmp/tsh_read_XXXXXX";
+  char out_path[] = "/tmp/tsh_read_XXXXXX";
+  int in_fd = mkstemp(in_path);
+  int out_fd = mkstemp(out_path);
+  string text = "one\ntwo x  y \nthree\nfour\n";
+  ASSERT_EQ(write(in_fd, text.data(), text.size()), (ssize_t)text.size());
+  lseek(in_fd, 0, SEEK_SET);
+  EXPECT_EQ(Pipeline("read A; read B C; cat").run(in_fd, out_fd), 0);
+  string value;
+  ASSERT_TRUE(get_variable("A", &value));
+  EXPECT_EQ(value, "one");
+  ASSERT_TRUE(get_variable("C", &value));
+  EXPECT_EQ(value, "x  y");
+  char buf[64];
+  ssize_t n = pread(out_fd, buf, sizeof(buf), 0);
+  EXPECT_EQ(string(buf, max<ssize_t>(n, 0)), "three\nfour\n");
+  close(in_fd);
+  close(out_fd);
+  unlink(in_path);
+  unlink(out_path);
+
+  string out;
+  EXPECT_EQ(Pipeline("cat | while read -r x; do echo [$x]; read y; echo $y; "
+                     "done | cat")
+                .run("1\n2\n3\n4\n", &out),
+            0);
+  EXPECT_EQ(out, "[1]\n2\n[3]\n4\n");
+
+  EXPECT_EQ(Pipeline("cat | mapfile -t -s 1 M").run("a\nb\nc", nullptr), 0);
+  ASSERT_TRUE(expand_word("${#M[@]}:${M[1]}", &value));
+  EXPECT_EQ(value, "2:c");
+  EXPECT_FALSE(expand_word("foo$", &value));
+}
+
+// stages of a pipeline walk the cpus of one L3 through shared L2s, and
+// successive pipelines alternate between NUMA nodes
+TEST(TopologyTest, Placement) {
+  vector<int> cpus = parse_cpu_list("0-2,5,7-8\n");
+  EXPECT_EQ(cpus, vector<int>({0, 1, 2, 5, 7, 8}));
+
+  // two nodes of one L3 each, two cores per L3, SMT siblings n and n+4
+  vector<CpuInfo> info;
+  for (int cpu = 0; cpu < 8; cpu++) {
+    int core = cpu % 4;
+    info.push_back({cpu, core / 2, core / 2 * 2, core});
+  }
+  CpuPlacer placer(info);
+  EXPECT_EQ(placer.first_stage(), 0);
+  EXPECT_EQ(placer.next_stage(0), 4) << "SMT sibling shares the L2";
+  EXPECT_EQ(placer.next_stage(4), 1);
+  EXPECT_EQ(placer.next_stage(5), 0) << "a long pipeline wraps in its L3";
+  EXPECT_EQ(placer.first_stage(), 2) << "the next job goes to the other node";
+  EXPECT_EQ(placer.first_stage(), 4);
+
+  char root[] = "/tmp/tsh_sysfs_XXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  string base = root;
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) cpu++;
+  string cache = base + "/cpu/cpu" + to_string(cpu) + "/cache/";
+  vector<string> dirs = {base + "/cpu", base + "/cpu/cpu" + to_string(cpu),
+                         cache, cache + "index0", cache + "index1",
+                         base + "/node", base + "/node/node0",
+                         base + "/node/node1"};
+  for (const string &dir : dirs) mkdir(dir.c_str(), 0700);
+  auto put = [](const string &path, const string &text) {
+    ofstream(path) << text << "\n";
+  };
+  put(cache + "index0/level", "2");
+  put(cache + "index0/type", "Unified");
+  put(cache + "index0/shared_cpu_list", to_string(cpu) + ",1000");
+  put(cache + "index1/level", "3");
+  put(cache + "index1/type", "Unified");
+  put(cache + "index1/shared_cpu_list", "0-1023");
+  put(base + "/node/node0/cpulist", "1000-1001");
+  put(base + "/node/node1/cpulist", "0-999");
+  vector<CpuInfo> found = read_cpu_topology(base);
+  ASSERT_FALSE(found.empty());
+  EXPECT_EQ(found[0].cpu, cpu);
+  EXPECT_EQ(found[0].node, 1);
+  EXPECT_EQ(found[0].l2, cpu);
+  EXPECT_EQ(found[0].l3, 0);
+  system(("rm -rf " + base).c_str());
+}
+
+// a qos prefix demotes every stage of its pipeline and never the shell
+TEST(QosTest, PrefixDemotesPipeline) {
+  list<Process *> process_list;
+  parse_input((char *)"qos idle a b | c; d", process_list);
+  vector<Process *> stages(process_list.begin(), process_list.end());
+  EXPECT_STREQ(stages[0]->cmdTokens[0], "a");
+  EXPECT_STREQ(stages[0]->cmdTokens[1], "b");
+  EXPECT_EQ(stages[0]->cmdTokens[2], nullptr);
+  EXPECT_EQ(stages[0]->qos, QOS_IDLE);
+  EXPECT_EQ(stages[1]->qos, QOS_IDLE);
+  EXPECT_EQ(stages[2]->qos, QOS_NORMAL);
+  cleanup(process_list, nullptr);
+
+  int before = getpriority(PRIO_PROCESS, 0);
+  string out;
+  EXPECT_EQ(Pipeline("qos batch nice | cat").run("", &out), 0);
+  EXPECT_EQ(atoi(out.c_str()), max(before, QOS_BATCH_NICE));
+  out.clear();
+  EXPECT_EQ(Pipeline("qos idle echo hi").run("", &out), 0);
+  EXPECT_EQ(out, "hi\n");
+  EXPECT_EQ(getpriority(PRIO_PROCESS, 0), before);
+  int null_fd = open("/dev/null", O_WRONLY);
+  EXPECT_EQ(Pipeline("qos fast ls").run(-1, -1, null_fd), 2);
+  close(null_fd);
+}
+
+// fork() leaves forkless memory out of the child, so launching a command
+// costs the same however large the shell's caches grow
+TEST(ForklessTest, ForkLatencyStaysFlat) {
+  auto fork_us = []() {
+    vector<double> samples;
+    for (int i = 0; i < 21; i++) {
+      auto start = chrono::steady_clock::now();
+      pid_t pid = fork();
+      if (pid == 0) _exit(0);
+      waitpid(pid, NULL, 0);
+      samples.push_back(chrono::duration<double, micro>(
+                            chrono::steady_clock::now() - start)
+                            .count());
+    }
+    sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+  };
+  double before = fork_us();
+  // every page written, as a filled cache would be
+  size_t size = 128 << 20;
+  forkless_block cache((char *)forkless_alloc(size), ForklessFree{size});
+  ASSERT_NE(cache.get(), nullptr);
+  memset(cache.get(), 1, size);
+  double after = fork_us();
+  EXPECT_LT(after, before * 2 + 200) << "fork took " << before << "us, then "
+                                     << after << "us";
+
+}
+
+// aliases and calls are expanded when parsed, and a redefinition is seen
+// even though the expansion was cached
+TEST(AliasTest, ExpandAndCache) {
+  string out;
+  EXPECT_EQ(Pipeline("alias t_up='tr a-z A-Z'; t_fn() { echo $2 $1 [$#] | "
+                     "t_up; }")
+                .run("", nullptr),
+            0);
+  EXPECT_EQ(Pipeline("t_fn a b | cat").run("", &out), 0);
+  EXPECT_EQ(out, "B A [2]\n");
+  uint64_t version = definitions_version();
+  EXPECT_EQ(Pipeline("t_fn() { echo new $1; }").run("", nullptr), 0);
+  EXPECT_GT(definitions_version(), version);
+  out.clear();
+  EXPECT_EQ(Pipeline("t_fn a b | cat").run("", &out), 0);
+  EXPECT_EQ(out, "new a\n");
+
+  // a builtin-only call runs on a thread of the shell, so its read is seen
+  EXPECT_EQ(Pipeline("t_rd() { read t_var; }; t_self() { t_self; }")
+                .run("", nullptr),
+            0);
+  EXPECT_EQ(Pipeline("cat | t_rd").run("v\n", nullptr), 0);
+  string value;
+  ASSERT_TRUE(get_variable("t_var", &value));
+  EXPECT_EQ(value, "v");
+
+  // no recursion: the inner call is left alone and not found
+  EXPECT_EQ(Pipeline("t_self").run("", nullptr), 127);
+  EXPECT_EQ(
+      Pipeline("unalias t_up; unset -f t_fn t_rd t_self").run("", nullptr), 0);
+  string body;
+  EXPECT_FALSE(get_alias("t_up", &body));
+  EXPECT_FALSE(get_function("t_fn", &body));
+}
+
+// a definitions-only rc is parsed once, then replayed from its snapshot
+TEST(RcTest, SnapshotReplaysDefinitions) {
+  char dir[] = "/tmp/tsh_rc_XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  string rc = string(dir) + "/rc", cache = string(dir) + "/cache";
+  setenv("TSH_RC_BASE", "base", 1);
+  {
+    ofstream out(rc);
+    out << "# defs\nRC_A=1; export RC_B=$RC_A-$TSH_RC_BASE\n"
+        << "export RC_A\nunset TSH_RC_BASE\n";
+  }
+  EXPECT_EQ(load_rc(rc, cache), RC_COMPILED);
+  EXPECT_STREQ(getenv("RC_B"), "1-base");
+  EXPECT_STREQ(getenv("RC_A"), "1");
+  EXPECT_EQ(getenv("TSH_RC_BASE"), nullptr);
+
+  // values are expanded against the environment of each startup
+  setenv("TSH_RC_BASE", "other", 1);
+  unsetenv("RC_A");
+  unsetenv("RC_B");
+  EXPECT_EQ(load_rc(rc, cache), RC_MAPPED);
+  EXPECT_STREQ(getenv("RC_B"), "1-other");
+  EXPECT_STREQ(getenv("RC_A"), "1");
+
+  // an edit gets a new snapshot; a command makes the file run every time
+  { ofstream(rc, ios::app) << "RC_C=3\n"; }
+  EXPECT_EQ(load_rc(rc, cache), RC_COMPILED);
+  { ofstream(rc, ios::app) << "true\n"; }
+  EXPECT_EQ(load_rc(rc, cache), RC_RAN);
+  EXPECT_EQ(load_rc(rc, cache), RC_RAN);
+  string value;
+  ASSERT_TRUE(get_variable("RC_C", &value));
+  EXPECT_EQ(value, "3");
+  unsetenv("RC_A");
+  unsetenv("RC_B");
+  system(("rm -rf " + string(dir)).c_str());
+}
+
+TEST(RecordTest, SessionsRoundTrip) {
+  char path[] = "/tmp/tsh_record_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  string old_lang = getenv("LANG") ? getenv("LANG") : "";
+  setenv("LANG", "C", 1);
+  {
+    SessionRecorder first(path);
+    // command times count from the start of the session
+    uint64_t t = chrono::duration_cast<chrono::nanoseconds>(
+                     chrono::system_clock::now().time_since_epoch())
+                     .count();
+    ASSERT_TRUE(first.ok());
+    first.record("echo one", t + 1000, 10, 0);
+    // a second shell appends to the same file between two commands
+    pid_t pid = fork();
+    if (pid == 0) {
+      SessionRecorder second(path);
+      second.record("sleep 1", t + 1500, 1000000000, 0);
+      _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    setenv("LANG", "POSIX", 1);
+    first.record("false", t + 3000, 20, 1);
+  }
+  // a record cut short is left out
+  { ofstream(path, ios::app | ios::binary) << "C\x05\x01"; }
+
+  vector<RecordedSession> sessions;
+  ASSERT_TRUE(read_recording(path, &sessions));
+  ASSERT_EQ(sessions.size(), 2u);
+  const RecordedSession &a = sessions[0], &b = sessions[1];
+  EXPECT_EQ(a.id, (uint64_t)getpid());
+  ASSERT_EQ(a.commands.size(), 2u);
+  EXPECT_EQ(a.commands[0].line, "echo one");
+  EXPECT_EQ(a.commands[1].start_ns - a.commands[0].start_ns, 2000u);
+  EXPECT_EQ(a.commands[1].line, "false");
+  EXPECT_EQ(a.commands[1].duration_ns, 20u);
+  EXPECT_EQ(a.commands[1].status, 1);
+  char cwd[PATH_MAX];
+  EXPECT_EQ(a.cwd, getcwd(cwd, sizeof(cwd)));
+  // the change of LANG between the commands was recorded
+  ASSERT_EQ(a.envs.size(), 2u);
+  auto lang = [](const vector<pair<string, string>> &env) {
+    for (auto &var : env) {
+      if (var.first == "LANG") return var.second;
+    }
+    return string();
+  };
+  EXPECT_EQ(lang(a.envs[a.commands[0].env]), "C");
+  EXPECT_EQ(lang(a.envs[a.commands[1].env]), "POSIX");
+  ASSERT_EQ(b.commands.size(), 1u);
+  EXPECT_EQ(b.commands[0].line, "sleep 1");
+  EXPECT_EQ(b.commands[0].duration_ns, 1000000000u);
+
+  if (old_lang.empty()) {
+    unsetenv("LANG");
+  } else {
+    setenv("LANG", old_lang.c_str(), 1);
+  }
+  unlink(path);
+}
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);